@@ -3,21 +3,175 @@
 //
 #include <iostream>
 #include "./tools/helper.h"
+#include "./tools/logger.h"
+#include "./tools/metrics.h"
+#include "./tools/trace.h"
+#include "./tools/artifacts.h"
+#include "./tools/matpool.h"
 #include "./model/model.h"
 
 using namespace std;
 
+//Bradley & Roth straight from the definition (double integral from OpenCV), used by '-d' as the golden output
+static void bradleyReference(const Mat &inputMat, Mat &outputMat, float T){
+
+    Mat integralMat;
+    integral(inputMat, integralMat, CV_64F);
+
+    int s2 = (inputMat.cols / 8) / 2;
+    outputMat.create(inputMat.size(), CV_8U);
+
+    for (int y = 0; y < inputMat.rows; y++)
+        for (int x = 0; x < inputMat.cols; x++) {
+            int x1 = max(x - s2, 0), x2 = min(x + s2, inputMat.cols - 1);
+            int y1 = max(y - s2, 0), y2 = min(y + s2, inputMat.rows - 1);
+            int count = (x2 - x1) * (y2 - y1);
+            double sum = integralMat.at<double>(y2 + 1, x2 + 1) - integralMat.at<double>(y1 + 1, x2 + 1) -
+                         integralMat.at<double>(y2 + 1, x1 + 1) + integralMat.at<double>(y1 + 1, x1 + 1);
+            outputMat.at<uchar>(y, x) = ((float) (inputMat.at<uchar>(y, x) * count) < (float) sum * (1.0f - T) ? 0 : 255);
+        }
+}
+
+//Niblack, Sauvola and Wolf-Jolion straight from the definition (double integral from OpenCV), used by '-d' as the golden output
+static void localReference(const Mat &inputMat, Mat &outputMat, enumBinarization method, int winX, int winY, double k, double dR){
+
+    Mat sumMat, sqMat;
+    integral(inputMat, sumMat, sqMat, CV_64F);
+
+    int wxh = winX / 2, wyh = winY / 2;
+    Mat meanMat(inputMat.rows, inputMat.cols, CV_32F), deviationMat(inputMat.rows, inputMat.cols, CV_32F);
+    double maxS = 0, minI, maxI;
+    minMaxLoc(inputMat, &minI, &maxI);
+
+    //statistics of every full window, stored at its centre
+    for (int y = wyh; y <= inputMat.rows - wyh - 1; y++)
+        for (int x = wxh; x <= inputMat.cols - winX + wxh; x++) {
+            int x1 = x - wxh, y1 = y - wyh;
+            double sum = sumMat.at<double>(y1 + winY, x1 + winX) - sumMat.at<double>(y1, x1 + winX) - sumMat.at<double>(y1 + winY, x1) + sumMat.at<double>(y1, x1);
+            double sq = sqMat.at<double>(y1 + winY, x1 + winX) - sqMat.at<double>(y1, x1 + winX) - sqMat.at<double>(y1 + winY, x1) + sqMat.at<double>(y1, x1);
+            float m = (float) (sum / (winX * winY));
+            float s = (float) sqrt((sq - m * sum) / (winX * winY));
+            meanMat.at<float>(y, x) = m;
+            deviationMat.at<float>(y, x) = s;
+            if (s > maxS) maxS = s;
+        }
+
+    //border pixels take the nearest full window
+    outputMat.create(inputMat.size(), CV_8U);
+    for (int y = 0; y < inputMat.rows; y++)
+        for (int x = 0; x < inputMat.cols; x++) {
+            int cy = min(max(y, wyh), inputMat.rows - wyh - 1);
+            int cx = (x < wxh ? wxh : (x >= inputMat.cols - wxh - 1 ? inputMat.cols - winX + wxh : x));
+            double m = meanMat.at<float>(cy, cx), s = deviationMat.at<float>(cy, cx);
+            double th = (method == binarization_NIBLACK ? m + k * s :
+                        (method == binarization_SAUVOLA ? m * (1 + k * (s / dR - 1)) : m + k * (s / maxS - 1) * (m - minI)));
+            outputMat.at<uchar>(y, x) = (inputMat.at<uchar>(y, x) >= (float) th ? 255 : 0);
+        }
+}
+
+//Milliseconds per run of the Bradley kernel
+static double benchmarkBradley(Mat &inputMat, int runs){
+
+    Mat outputMat;
+    int64 start = getTick();
+    for (int i = 0; i < runs; i++)
+        bradley_Binarization(inputMat, outputMat, 0.15f);
+    return getDiff(start) * 1000.0 / runs;
+}
+
+//Milliseconds per run of a Niblack, Sauvola or Wolf-Jolion kernel
+static double benchmarkLocal(Mat &inputMat, enumBinarization method, int winX, int winY, double k, int runs){
+
+    Mat outputMat;
+    int64 start = getTick();
+    for (int i = 0; i < runs; i++)
+        NiblackSauvolaWolfJolion(inputMat, outputMat, method, winX, winY, k, 128);
+    return getDiff(start) * 1000.0 / runs;
+}
+
+//One line of the '--compare' table: accuracy and classification latency of a model over the test documents
+static void logTestSummary(string modelFilename, const TestSummary &summary){
+
+    Log(log_Debug, "main.cpp", "main", "      %-16s %7li %8.2f%% %12.3f   %s", summary.classifier.c_str(), summary.samples,
+        (summary.samples > 0 ? summary.successes * 100.0 / summary.samples : 0), (summary.samples > 0 ? summary.seconds * 1000 / summary.samples : 0),
+        modelFilename.c_str());
+}
+
 int main(int argc, char **argv){
 
     //TODO:  1) Play with com o Tesseract:
     //          #include <tesseract/baseapi.h>
     //          tesseract::TessBaseAPI ocr;
     //TODO:  2) Check what is the optimized size of a dictionary (based on samples, number of labels, etc)
-    //TODO:  3) Create a loadImage to read multi image files (pdf, tiff, etc)...
     
     Model mod;
     int64 startTask = getTick();
 
+    //Splits the '--option value' pairs from the positional arguments
+    vector<string> args;
+    string metricsFile = "";
+    string traceFile = "";
+    string compareFilename = "";
+    enumClassifier classifier = model_BAG_OF_FEATURES;
+    enumMetricsFormat metricsFormat = metrics_JSON;
+    enumArtifactPolicy artifactPolicy = artifact_NONE;
+    int artifactSampleRate = 1;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--metrics" && i + 1 < argc)
+            metricsFile = argv[++i];
+        else if (arg == "--metrics-format" && i + 1 < argc)
+            metricsFormat = (toLower(argv[++i]) == "prometheus" ? metrics_PROMETHEUS : metrics_JSON);
+        else if (arg == "--threads" && i + 1 < argc)
+            mod.setLoaderThreads(atoi(argv[++i]));
+        else if (arg == "--refine")
+            mod.setRefineDictionary(true);
+        else if (arg == "--cache" && i + 1 < argc)
+            mod.setCacheFolder(argv[++i]);
+        else if (arg == "--stride" && i + 1 < argc)
+            mod.setFrameStride(atoi(argv[++i]));
+        else if (arg == "--gate" && i + 1 < argc)
+            mod.setGateThreshold(atof(argv[++i]));
+        else if (arg == "--smooth" && i + 1 < argc)
+            mod.setSmoothingWindow(atoi(argv[++i]));
+        else if (arg == "--read-depth" && i + 1 < argc)
+            mod.setReadDepth(atoi(argv[++i]));
+        else if (arg == "--streaming")
+            mod.setStreaming(true);
+        else if (arg == "--full-decode")
+            mod.setReducedDecode(false);
+        else if (arg == "--no-mat-pool")
+            setMatPool(false);
+        else if (arg == "--classifier" && i + 1 < argc)
+            classifier = (toLower(argv[++i]) == "projection" ? model_PROJECTION : model_BAG_OF_FEATURES);
+        else if (arg == "--bands" && i + 1 < argc)
+            mod.setProjectionBands(atoi(argv[++i]));
+        else if (arg == "--compare" && i + 1 < argc)
+            compareFilename = argv[++i];
+        else if (arg == "--artifacts" && i + 1 < argc) {
+            if (!parseArtifactPolicy(argv[++i], artifactPolicy, artifactSampleRate))
+                Log(log_Error, "main.cpp", "main", "   Unknown artifact policy '%s', no artifacts will be written.", argv[i]);
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+            traceFile = argv[++i];
+        else if (arg == "--log-level" && i + 1 < argc)
+            setLogLevel(atoi(argv[++i]));
+        else
+            args.push_back(arg);
+    }
+
+    //Intermediate images go to the temporary folder, written in the background
+    startArtifactWriter(artifactPolicy, artifactSampleRate);
+
+    //'kill -USR1 <pid>' dumps the metrics collected so far
+    enableMetricsDump((metricsFile != "" ? metricsFile : "metrics.json"), metricsFormat);
+
+    if (traceFile != "") {
+        startTrace(traceFile);
+        setTraceThreadName("main");
+    }
+
     Log(log_Error, "main.cpp", "main", "-------------------------------------------------------------------------------");
     Log(log_Error, "main.cpp", "main", "DORA: Document Analysis and Recognition");
     Log(log_Error, "main.cpp", "main", "Guttemberg Meirelles Machado - 2015");
@@ -25,17 +179,17 @@ int main(int argc, char **argv){
     Log(log_Error, "main.cpp", "main", "Log mode is:Logging and displaying: %s information.", getLogMode().c_str());
     Log(log_Error, "main.cpp", "main", "Logging and displaying: %s information.", getLogMode().c_str());
 
-    string arg1 = (argc > 1 ? toLower(argv[1]) : "-h");
-    string arg2 = (argc > 2 ? argv[2] : "");
-    string arg3 = (argc > 3 ? argv[3] : "");
-    string arg4 = (argc > 4 ? argv[4] : "");
+    string arg1 = (args.size() > 0 ? toLower(args[0]) : "-h");
+    string arg2 = (args.size() > 1 ? args[1] : "");
+    string arg3 = (args.size() > 2 ? args[2] : "");
+    string arg4 = (args.size() > 3 ? args[3] : "");
 
     Log(log_Debug, "main.cpp", "main", "   argument 1: '%s'", arg1.c_str());
     Log(log_Debug, "main.cpp", "main", "   argument 2: '%s'", arg2.c_str());
     Log(log_Debug, "main.cpp", "main", "   argument 3: '%s'", arg3.c_str());
     Log(log_Debug, "main.cpp", "main", "   argument 4: '%s'", arg4.c_str());
     
-    mod.setClassifierType(model_BAG_OF_FEATURES);
+    mod.setClassifierType(classifier);
     mod.setFeatureType(feature_SIFT);
     mod.setMatcherType(matcher_FLANN);
     mod.setBinarizationType(binarization_WOLFJOLION);
@@ -62,6 +216,48 @@ int main(int argc, char **argv){
                 //Saves the new created file
                 mod.save();
 
+        logMetrics();
+        if (metricsFile != "")
+            dumpMetrics(metricsFile, metricsFormat);
+
+    //Is it the update mode?
+    }else if (arg1 == "-u"){
+
+        Log(log_Debug, "main.cpp", "main", "Entering UPDATE mode:");
+
+        string inputPath = arg2;
+        string modelFilename = arg3;
+        string tempFolder = arg4;
+
+        mod.setFilename(modelFilename);
+        mod.setTempFolder(tempFolder);
+
+        //Initialize model engine
+        if(mod.initialize())
+
+            //Adds the new samples to the existing model
+            if(mod.update(inputPath))
+
+                //Saves the updated model over the old one
+                mod.save();
+
+        logMetrics();
+        if (metricsFile != "")
+            dumpMetrics(metricsFile, metricsFormat);
+
+    //Is it the convert mode?
+    }else if (arg1 == "-x"){
+
+        Log(log_Debug, "main.cpp", "main", "Entering CONVERT mode:");
+
+        string modelFilename = arg2;
+        string binaryFilename = arg3;
+
+        mod.setFilename(modelFilename);
+
+        //Writes the legacy YAML model as a model bundle
+        mod.convert(binaryFilename);
+
     //Is it the testing mode?
     }else if (arg1 == "-c") {
 
@@ -78,11 +274,31 @@ int main(int argc, char **argv){
         if (mod.initialize())
     
             //Loads and existing model file
-            if (mod.load())
-        
+            if (mod.load()) {
+
                 //Classifies the input path
-                mod.test(inputPath);
-        
+                TestSummary summary;
+                if (mod.test(inputPath, &summary) && compareFilename != "") {
+
+                    //The same documents go through the second model (its bundle brings its own engine and configuration)
+                    TestSummary compareSummary;
+                    mod.setFilename(compareFilename);
+                    if (mod.load() && mod.test(inputPath, &compareSummary)) {
+
+                        Log(log_Debug, "main.cpp", "main", "   Comparison:");
+                        Log(log_Debug, "main.cpp", "main", "      %-16s %7s %9s %12s   %s", "classifier", "samples", "accuracy", "ms/sample", "model");
+                        logTestSummary(modelFilename, summary);
+                        logTestSummary(compareFilename, compareSummary);
+                        if (summary.seconds > 0 && compareSummary.seconds > 0)
+                            Log(log_Debug, "main.cpp", "main", "      '%s' classified %.1fx as fast as '%s'.", compareFilename.c_str(),
+                                summary.seconds / compareSummary.seconds, modelFilename.c_str());
+                    }
+                }
+            }
+
+        logMetrics();
+        if (metricsFile != "")
+            dumpMetrics(metricsFile, metricsFormat);
         
     //Is it the webcam  mode?
     }else if (arg1 == "-w") {
@@ -105,6 +321,30 @@ int main(int argc, char **argv){
                 //Classifies the input path
                 mod.classifyCamera();
         
+    //Is it the video mode?
+    }else if (arg1 == "-v") {
+
+        Log(log_Debug, "main.cpp", "main", "Entering VIDEO mode:");
+
+        string videoFilename = arg2;
+        string modelFilename = arg3;
+        string csvFilename = arg4;
+
+        mod.setFilename(modelFilename);
+
+        //Initialize model engine
+        if (mod.initialize())
+
+            //Loads and existing model file
+            if (mod.load())
+
+                //Classifies the frames of the video, no window is opened
+                mod.classifyVideo(videoFilename, csvFilename);
+
+        logMetrics();
+        if (metricsFile != "")
+            dumpMetrics(metricsFile, metricsFormat);
+
     //Is it the debug mode
     }else if (arg1 == "-d"){
 
@@ -115,7 +355,53 @@ int main(int argc, char **argv){
         
         Sample s;
         s.setTemporaryFolder(tempPath);
-        
+
+        //the debug samples are only useful with their binary mats saved (unless another policy was asked for)
+        if (artifactPolicy == artifact_NONE)
+            startArtifactWriter(artifact_BINARY);
+
+        //---------------------------------- DEBUG ONLY ----------------------------------
+        //BINARIZATION KERNELS: GOLDEN OUTPUT AND BENCHMARK
+        //--------------------------------------------------------------------------------
+        Mat pageMat = imread(debugFolder + "page.png", IMREAD_GRAYSCALE);
+        if (isMatValid(pageMat)) {
+            Mat goldenMat, simdMat, scalarMat;
+            bradleyReference(pageMat, goldenMat, 0.15f);
+
+            bool simd = isBinarizationSIMD();
+            bradley_Binarization(pageMat, simdMat, 0.15f);
+            setBinarizationSIMD(false);
+            bradley_Binarization(pageMat, scalarMat, 0.15f);
+            double scalarMs = benchmarkBradley(pageMat, 20);
+            setBinarizationSIMD(true);
+            double simdMs = benchmarkBradley(pageMat, 20);
+
+            Log(log_Debug, "main.cpp", "main", "   Bradley on page.png (W:%i x H:%i): %i pixels differ from the golden output (%s), %i (scalar).",
+                pageMat.cols, pageMat.rows, countNonZero(simdMat != goldenMat), (simd ? "AVX2" : "scalar"), countNonZero(scalarMat != goldenMat));
+            Log(log_Debug, "main.cpp", "main", "   Bradley on page.png: %.2f ms (scalar), %.2f ms (%s), %i threads.",
+                scalarMs, simdMs, (simd ? "AVX2" : "scalar"), getNumThreads());
+
+            //same windows and constants as binarize()
+            enumBinarization localMethods[] = {binarization_NIBLACK, binarization_SAUVOLA, binarization_WOLFJOLION};
+            const char *localNames[] = {"Niblack", "Sauvola", "Wolf-Jolion"};
+            int winX = pageMat.cols / 12, winY = pageMat.rows / 12;
+            for (int i = 0; i < 3; i++) {
+                double k = (localMethods[i] == binarization_NIBLACK ? 0.2 : 0.5);
+                localReference(pageMat, goldenMat, localMethods[i], winX, winY, k, 128);
+                NiblackSauvolaWolfJolion(pageMat, simdMat, localMethods[i], winX, winY, k, 128);
+                setBinarizationSIMD(false);
+                NiblackSauvolaWolfJolion(pageMat, scalarMat, localMethods[i], winX, winY, k, 128);
+                scalarMs = benchmarkLocal(pageMat, localMethods[i], winX, winY, k, 20);
+                setBinarizationSIMD(true);
+                simdMs = benchmarkLocal(pageMat, localMethods[i], winX, winY, k, 20);
+
+                Log(log_Debug, "main.cpp", "main", "   %s on page.png: %i pixels differ from the golden output (%s), %i (scalar), %.2f ms (scalar), %.2f ms (%s).",
+                    localNames[i], countNonZero(simdMat != goldenMat), (simd ? "AVX2" : "scalar"), countNonZero(scalarMat != goldenMat),
+                    scalarMs, simdMs, (simd ? "AVX2" : "scalar"));
+            }
+        } else
+            Log(log_Error, "main.cpp", "main", "   Failed to read page.png, binarization kernels were not checked.");
+
         //---------------------------------- DEBUG ONLY ----------------------------------
         //TESTING THE RESCALE METHODS
         //--------------------------------------------------------------------------------
@@ -232,27 +518,61 @@ int main(int argc, char **argv){
         Log(log_Debug, "main.cpp", "main", "   options:");
         Log(log_Debug, "main.cpp", "main", "      -h      	Displays this information.");
         Log(log_Debug, "main.cpp", "main", "      -m      	Modeler Mode. Used to train a model based on a set of files.");
+        Log(log_Debug, "main.cpp", "main", "      -u      	Update Mode. Adds samples (and new labels) to an existing model, keeping its dictionary and retraining the SVM only.");
         Log(log_Debug, "main.cpp", "main", "      -c      	Classifier Mode; Used to classify documents.");
+        Log(log_Debug, "main.cpp", "main", "      -v      	Video Mode. Classifies the frames of a video file (no display needed) and writes 'frame,ms,label,reused' lines to a csv file.");
+        Log(log_Debug, "main.cpp", "main", "      -x      	Convert Mode. Writes a legacy YAML model (and its dictionary.yml) as a model bundle.");
         Log(log_Debug, "main.cpp", "main", "      sample_folder	Folder with pre-classified images. Sub-folder name should be the label of the pre-classified images.");
+        Log(log_Debug, "main.cpp", "main", "                   	A manifest (.txt/.lst) with one 'path' or 'label<TAB>path' per line can be used instead of the folder.");
         Log(log_Debug, "main.cpp", "main", "      document 	Document file or folder containing (jpg, png, bmp or pdf");
         Log(log_Debug, "main.cpp", "main", "      model_file  	Specify a model filename. It will be written in modeler mode, and read in classifier mode.");
+        Log(log_Debug, "main.cpp", "main", "      --metrics file      	Writes the per stage latency histograms and counters to file at the end of the run (kill -USR1 dumps them on demand).");
+        Log(log_Debug, "main.cpp", "main", "      --metrics-format fmt	Metrics file format: 'json' (default) or 'prometheus'.");
+        Log(log_Debug, "main.cpp", "main", "      --threads n         	Number of image decode threads (default is one per core).");
+        Log(log_Debug, "main.cpp", "main", "      --cache folder      	Modeler mode only: keeps the pre-processed samples and their descriptors in 'folder', so unchanged files are not processed again.");
+        Log(log_Debug, "main.cpp", "main", "      --stride n          	Video mode only: classifies one frame in n (default is every frame).");
+        Log(log_Debug, "main.cpp", "main", "      --gate level        	Camera and video modes: mean gray level change (of a 16x16 thumbnail) below which the previous label is reused (default is 3, 0 classifies every frame).");
+        Log(log_Debug, "main.cpp", "main", "      --smooth n          	Camera and video modes: the label is the majority of the last n predictions (default is 5, 1 turns it off).");
+        Log(log_Debug, "main.cpp", "main", "      --read-depth n      	Number of file reads kept in flight by the loader (default is 32).");
+        Log(log_Debug, "main.cpp", "main", "      --refine            	Update mode only: refines the dictionary words with the new descriptors (online k-means).");
+        Log(log_Debug, "main.cpp", "main", "      --streaming         	Modeler mode only: pre-processes and extracts each sample as it is loaded, keeping only its descriptors in memory.");
+        Log(log_Debug, "main.cpp", "main", "      --full-decode       	Decodes every image at full size and in colour (by default JPEG files are decoded already reduced to the sample dimension, in grayscale).");
+        Log(log_Debug, "main.cpp", "main", "      --no-mat-pool       	Allocates the pre-processing mats from the heap instead of reusing per-thread pooled buffers.");
+        Log(log_Debug, "main.cpp", "main", "      --classifier name   	Modeler mode only: 'bof' (bag of SIFT features, default) or 'projection' (resampled XY projection profiles, no SIFT).");
+        Log(log_Debug, "main.cpp", "main", "      --bands n           	Modeler mode only: stripes of the page with their own projection profiles (default is 4, 0 turns them off).");
+        Log(log_Debug, "main.cpp", "main", "      --compare model     	Classifier mode only: classifies the documents with a second model too, and logs the accuracy and latency of both.");
+        Log(log_Debug, "main.cpp", "main", "      --artifacts policy  	Intermediate images written to the temporary folder: 'none' (default), 'binary', 'all' or 'sampled:N' (every stage of one sample in N).");
+        Log(log_Debug, "main.cpp", "main", "      --trace file        	Writes Chrome trace-event spans of the run to file (open it in chrome://tracing or ui.perfetto.dev).");
+        Log(log_Debug, "main.cpp", "main", "      --log-level n       	0=errors, 1=warnings, 2=debug (default), 3=details.");
         Log(log_Debug, "main.cpp", "main", "");
         Log(log_Debug, "main.cpp", "main", "   examples:");
         Log(log_Debug, "main.cpp", "main", "      dora -h");
         Log(log_Debug, "main.cpp", "main", "      dora -m 'c:/samples/' 'c:/docs/model.xml'");
         Log(log_Debug, "main.cpp", "main", "      dora -c 'c:/docs/doc.jpg' 'c:/docs/model.xml'");
         Log(log_Debug, "main.cpp", "main", "      dora -c 'c:/docs' 'c:/docs/model.xml'");
+        Log(log_Debug, "main.cpp", "main", "      dora -m 'c:/samples/' 'c:/docs/projection.dmdl' --classifier projection");
+        Log(log_Debug, "main.cpp", "main", "      dora -c 'c:/docs' 'c:/docs/model.xml' --compare 'c:/docs/projection.dmdl'");
+        Log(log_Debug, "main.cpp", "main", "      dora -v 'c:/videos/footage.mp4' 'c:/docs/model.xml' 'c:/videos/footage.csv' --stride 5");
+        Log(log_Debug, "main.cpp", "main", "      dora -x 'c:/docs/model.xml' 'c:/docs/model.dmdl'");
         Log(log_Debug, "main.cpp", "main", "      dora -c 'c:/docs/*.png' 'c:/docs/model.xml'");
+        Log(log_Debug, "main.cpp", "main", "      dora -c 'c:/docs' 'c:/docs/model.xml' --metrics 'c:/docs/metrics.prom' --metrics-format prometheus");
     }else{
         Log(log_Error, "main.cpp", "main", "   Unknown command line argument. Try 'dora --h' for more information.");
     }
 
+    stopArtifactWriter();
+    stopTrace();
+
     Log(log_Error, "main.cpp", "main", "Finished after %s seconds.", getDiffString(startTask).c_str());
     Log(log_Error, "main.cpp", "main", "-------------------------------------------------------------------------------");
 
     Log(log_Error, "main.cpp", "main", "Press any key to exit");
+    flushLogger();
     getchar();
 
+    //Writes whatever is still on the log ring and closes the log file
+    stopLogger();
+
     //exit
     return 0;
 
@@ -0,0 +1,222 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <fstream>
+#include "cache.h"
+
+#define CACHE_MAGIC         "DORADSC1"
+#define CACHE_MAGIC_LENGTH  8
+
+static void writeInt(ofstream &f, int32_t value) {
+    f.write((const char *) &value, sizeof(value));
+}
+
+static bool readInt(ifstream &f, int32_t &value) {
+    return (bool) f.read((char *) &value, sizeof(value));
+}
+
+static void writeMat(ofstream &f, const Mat &m) {
+    writeInt(f, m.rows);
+    writeInt(f, m.cols);
+    writeInt(f, m.type());
+    size_t rowSize = m.cols * m.elemSize();
+    for (int r = 0; r < m.rows; r++)
+        f.write((const char *) m.ptr(r), rowSize);
+}
+
+static bool readMat(ifstream &f, Mat &m) {
+
+    int32_t rows, cols, type;
+    if (!readInt(f, rows) || !readInt(f, cols) || !readInt(f, type) || rows < 0 || cols < 0)
+        return false;
+
+    if (rows == 0 || cols == 0) {
+        m.release();
+        return true;
+    }
+
+    m.create(rows, cols, type);
+    return (bool) f.read((char *) m.data, m.total() * m.elemSize());
+}
+
+SampleCache::SampleCache() {
+
+    //Initialize the internal variables
+    mFolder = "";
+    mParameters = "";
+    mHits = 0;
+    mMisses = 0;
+    mStores = 0;
+
+}
+
+void SampleCache::setFolder(string folder) {
+
+    if (folder != "" && folder[folder.size() - 1] != '/')
+        folder += "/";
+
+    mFolder = folder;
+
+    if (mFolder != "" && !createFolder(mFolder)) {
+        Log(log_Error, "cache.cpp", "setFolder", "      Cache folder '%s' cannot be used, caching is off.", mFolder.c_str());
+        mFolder = "";
+    }
+}
+
+//Everything that changes the cached mats must be part of the parameters
+void SampleCache::setParameters(string parameters) {
+    mParameters = parameters;
+}
+
+bool SampleCache::isEnabled() {
+    return (mFolder != "");
+}
+
+long SampleCache::getHits() {
+    return mHits;
+}
+
+long SampleCache::getMisses() {
+    return mMisses;
+}
+
+long SampleCache::getStores() {
+    return mStores;
+}
+
+void SampleCache::resetCounters() {
+    mHits = 0;
+    mMisses = 0;
+    mStores = 0;
+}
+
+string SampleCache::getKey(const vector<uchar> &data) {
+
+    if (!isEnabled() || data.empty())
+        return "";
+
+    char key[40];
+    unsigned long long contentHash = getHash(data.data(), data.size());
+    unsigned long long parametersHash = getHash(mParameters.data(), mParameters.size());
+    snprintf(key, sizeof(key), "%016llx-%016llx", contentHash, parametersHash);
+    return key;
+}
+
+//Runs on the loader workers
+bool SampleCache::load(string key, string filename, string label, Sample &s) {
+
+    if (!isEnabled() || key == "")
+        return false;
+
+    try {
+        ifstream f((mFolder + key + ".dsc").c_str(), ios::binary);
+
+        if (f.is_open()) {
+
+            char magic[CACHE_MAGIC_LENGTH];
+            int32_t parametersLength, width, height, keypointCount;
+
+            bool valid = f.read(magic, CACHE_MAGIC_LENGTH) && memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_LENGTH) == 0 &&
+                         readInt(f, parametersLength) && parametersLength == (int32_t) mParameters.size();
+
+            string parameters(valid ? parametersLength : 0, '\0');
+            valid = valid && f.read(&parameters[0], parametersLength) && parameters == mParameters &&
+                    readInt(f, width) && readInt(f, height) &&
+                    readMat(f, s.binaryMat) && readInt(f, keypointCount) && keypointCount >= 0;
+
+            if (valid) {
+                s.features.resize(keypointCount);
+                for (int32_t i = 0; i < keypointCount && valid; i++) {
+                    KeyPoint &k = s.features[i];
+                    float values[5];
+                    int32_t octave, classId;
+                    valid = f.read((char *) values, sizeof(values)) && readInt(f, octave) && readInt(f, classId);
+                    k.pt = Point2f(values[0], values[1]);
+                    k.size = values[2];
+                    k.angle = values[3];
+                    k.response = values[4];
+                    k.octave = octave;
+                    k.class_id = classId;
+                }
+            }
+
+            valid = valid && readMat(f, s.dic_descriptors);
+
+            if (valid && isMatValid(s.binaryMat) && !s.dic_descriptors.empty()) {
+                s.setCached(filename, label, Size(width, height), key);
+                mHits++;
+                Log(log_Detail, "cache.cpp", "load", "      Sample '%s' was found in the cache.", filename.c_str());
+                return true;
+            }
+
+            //a truncated or foreign entry is simply rebuilt
+            s.binaryMat.release();
+            s.features.clear();
+            s.dic_descriptors.release();
+            Log(log_Warning, "cache.cpp", "load", "      Ignoring invalid cache entry '%s'.", key.c_str());
+        }
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "cache.cpp", "load", "      Error reading cache entry: %s", e.what());
+    }
+
+    mMisses++;
+    return false;
+}
+
+//Writes the entry to a temporary file first, so a crashed run never leaves a half written entry behind
+bool SampleCache::store(Sample &s) {
+
+    string key = s.getCacheKey();
+
+    if (!isEnabled() || key == "" || !isMatValid(s.binaryMat) || s.dic_descriptors.empty())
+        return false;
+
+    try {
+        string filename = mFolder + key + ".dsc";
+        string temporaryFilename = filename + ".tmp";
+
+        {
+            ofstream f(temporaryFilename.c_str(), ios::binary | ios::trunc);
+            if (!f.is_open()) {
+                Log(log_Error, "cache.cpp", "store", "      Failed to create cache entry '%s'.", temporaryFilename.c_str());
+                return false;
+            }
+
+            f.write(CACHE_MAGIC, CACHE_MAGIC_LENGTH);
+            writeInt(f, (int32_t) mParameters.size());
+            f.write(mParameters.data(), mParameters.size());
+            writeInt(f, s.getOriginalSize().width);
+            writeInt(f, s.getOriginalSize().height);
+            writeMat(f, s.binaryMat);
+
+            writeInt(f, (int32_t) s.features.size());
+            for (size_t i = 0; i < s.features.size(); i++) {
+                const KeyPoint &k = s.features[i];
+                float values[5] = {k.pt.x, k.pt.y, k.size, k.angle, k.response};
+                f.write((const char *) values, sizeof(values));
+                writeInt(f, k.octave);
+                writeInt(f, k.class_id);
+            }
+
+            writeMat(f, s.dic_descriptors);
+
+            if (!f.good()) {
+                Log(log_Error, "cache.cpp", "store", "      Failed to write cache entry '%s'.", temporaryFilename.c_str());
+                f.close();
+                remove(temporaryFilename.c_str());
+                return false;
+            }
+        }
+
+        if (rename(temporaryFilename.c_str(), filename.c_str()) == 0) {
+            mStores++;
+            return true;
+        }
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "cache.cpp", "store", "      Error writing cache entry: %s", e.what());
+    }
+
+    return false;
+}
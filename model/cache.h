@@ -0,0 +1,56 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Content-addressed cache of pre-processed samples. An entry holds the binary
+// mat, the keypoints and the descriptors of one image file, and it is keyed by
+// the hash of the file bytes plus the hash of every parameter that changes
+// them (rescale method, sample dimension, binarization, feature type...).
+// Editing, renaming or moving a file never returns stale data, and changing a
+// parameter simply misses.
+//
+// Entry layout (<folder>/<content hash>-<parameters hash>.dsc, little endian):
+//
+//   "DORADSC1" | parameters (length + bytes) | original width, height
+//   | binary mat | keypoint count + keypoints | descriptors mat
+//
+// where a mat is rows, cols, type followed by the rows of pixels.
+//
+
+#ifndef DORA_CACHE_H
+#define DORA_CACHE_H
+
+#include <atomic>
+#include "../tools/helper.h"
+#include "sample.h"
+
+using namespace std;
+
+class SampleCache {
+    string          mFolder;
+    string          mParameters;
+    atomic<long>    mHits;
+    atomic<long>    mMisses;
+    atomic<long>    mStores;
+
+public:
+    //Constructors
+    SampleCache();
+
+    //Methods
+    string      getKey(const vector<uchar> &data);
+    bool        load(string key, string filename, string label, Sample &s);
+    bool        store(Sample &s);
+    void        resetCounters();
+
+    //Setters
+    void        setFolder(string folder);
+    void        setParameters(string parameters);
+
+    //Getters
+    bool        isEnabled();
+    long        getHits();
+    long        getMisses();
+    long        getStores();
+};
+
+#endif
@@ -27,7 +27,7 @@ void Class::calculateAverageSampleWidth(){
 
         int sum = 0;
         for (int i = 0; i < samples.size(); i++) {
-            sum = sum + samples[i].originalMat.cols;
+            sum = sum + samples[i].getOriginalSize().width;
         }
 
         mAverageSampleWidth =  sum / (int) samples.size();
@@ -41,7 +41,7 @@ void Class::calculateAverageSampleHeight(){
 
         int sum = 0;
         for (int i = 0; i < samples.size(); i++) {
-            sum = sum + samples[i].originalMat.rows;
+            sum = sum + samples[i].getOriginalSize().height;
         }
 
         mAverageSampleHeight = sum / (int) samples.size();
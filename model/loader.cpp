@@ -0,0 +1,370 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <thread>
+#include <atomic>
+#include <map>
+#include <fstream>
+#include <condition_variable>
+#include "loader.h"
+
+SampleLoader::SampleLoader() {
+
+    //Initialize the internal variables
+    mThreads = 0;
+    mQueueSize = 0;
+    mReadDepth = 32;
+    mTemporaryFolder = "";
+    mDesiredDimension = 0;
+    mRescaleMethod = rescale_NONE;
+    mGrayscale = false;
+    mCache = NULL;
+    mLoadedCount = 0;
+    mThroughput = 0;
+
+}
+
+void SampleLoader::setThreads(int threads) {
+    mThreads = threads;
+}
+
+void SampleLoader::setQueueSize(int size) {
+    mQueueSize = size;
+}
+
+//Number of file reads kept in flight at once
+void SampleLoader::setReadDepth(int depth) {
+    mReadDepth = (depth > 0 ? depth : 1);
+}
+
+void SampleLoader::setTemporaryFolder(string folder) {
+    mTemporaryFolder = folder;
+}
+
+//Lets the workers decode each file close to the size pre-processing will reduce it to
+void SampleLoader::setDecodeHint(int desiredDimension, enumRescale rescaleMethod, bool grayscale) {
+    mDesiredDimension = desiredDimension;
+    mRescaleMethod = rescaleMethod;
+    mGrayscale = grayscale;
+}
+
+//Files found in the cache come back already pre-processed, with their keypoints and descriptors
+void SampleLoader::setCache(SampleCache *cache) {
+    mCache = cache;
+}
+
+int SampleLoader::getThreads() {
+    //Zero means one decode worker per core
+    if (mThreads > 0)
+        return mThreads;
+    int cores = (int) thread::hardware_concurrency();
+    return (cores > 0 ? cores : 1);
+}
+
+long SampleLoader::getLoadedCount() {
+    return mLoadedCount;
+}
+
+double SampleLoader::getThroughput() {
+    return mThroughput;
+}
+
+bool isManifest(string path) {
+    string extension = toLower(path.substr(path.find_last_of(".") + 1));
+    return (extension == "txt" || extension == "lst" || extension == "manifest");
+}
+
+//Runs on the feeder thread. A manifest has one sample per line, either 'path' or 'label<TAB>path'.
+//Relative paths are relative to the manifest folder.
+void SampleLoader::feed(string path, bool labelFromFolder, BoundedQueue<SampleJob> &jobs, function<bool()> acquireSlot) {
+
+    vector<string> files;
+    vector<string> labels;
+    string root;
+
+    if (isFolder(path)) {
+        root = path;
+        files = listFiles(path);
+    } else if (isManifest(path)) {
+        root = getFolderName(path) + "/";
+        ifstream manifest(path.c_str());
+        string line;
+        while (getline(manifest, line)) {
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            if (line.empty() || line[0] == '#')
+                continue;
+            size_t tab = line.find('\t');
+            string file = (tab == string::npos ? line : line.substr(tab + 1));
+            if (file.empty())
+                continue;
+            if (file[0] != '/')
+                file = root + file;
+            files.push_back(file);
+            labels.push_back(tab == string::npos ? "" : line.substr(0, tab));
+        }
+    } else if (isFile(path)) {
+        root = getFolderName(path) + "/";
+        files.push_back(path);
+    }
+
+    Log(log_Debug, "loader.cpp", "feed", "         %i files found.", files.size());
+
+    for (size_t i = 0; i < files.size(); i++) {
+
+        SampleJob job;
+        job.index = 0;
+        job.filename = files[i];
+        job.page = -1;
+        job.dataRead = false;
+
+        //creates a class label based on the folder where the file is located (same rule as before the loader existed)
+        if (i < labels.size() && labels[i] != "")
+            job.label = labels[i];
+        else if (labelFromFolder)
+            job.label = replace(getFolderName(files[i]), root, "");
+        else
+            job.label = "Image" + to_string(i + 1);
+
+        if (!acquireSlot() || !jobs.push(job))
+            break;
+    }
+
+    jobs.close();
+}
+
+//Runs on the reader thread. Every job waiting in the queue joins the batch (up to the read depth), so
+//reads are only batched when there is a backlog and a lone job is never held back.
+//The reader numbers the samples, and splits multi-page files into one job per page once their bytes are in:
+//nothing but the file list is touched on the feeder thread. Pages after the first take a page slot.
+void SampleLoader::read(BoundedQueue<SampleJob> &jobs, BoundedQueue<SampleJob> &readJobs, BufferPool &pool, function<bool()> acquirePageSlot) {
+
+    BatchFileReader reader(mReadDepth);
+    SampleJob job;
+    long index = 0;
+
+    while (jobs.pop(job)) {
+
+        vector<SampleJob> batch;
+        batch.push_back(std::move(job));
+        while (batch.size() < (size_t) mReadDepth && jobs.tryPop(job))
+            batch.push_back(std::move(job));
+
+        vector<FileRead> reads(batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            reads[i].filename = batch[i].filename;
+            reads[i].data = pool.acquire();
+            reads[i].ok = false;
+        }
+
+        {
+            TraceSpan span("readBatch", to_string(reads.size()).c_str());
+            MetricTimer timer(metric_FILE_READ);
+            reader.readBatch(reads);
+        }
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            batch[i].data.swap(reads[i].data);
+            batch[i].dataRead = reads[i].ok;
+
+            //PDF files are always rasterized page by page, even single page ones
+            int pageCount = 1;
+            bool paged = false;
+            if (batch[i].dataRead) {
+                pageCount = getPageCount(batch[i].data.data(), batch[i].data.size());
+                paged = (pageCount > 1 || isPagedFormat(getImageFormat(batch[i].data.data(), batch[i].data.size())));
+            }
+
+            if (!paged) {
+                batch[i].index = index++;
+                if (!readJobs.push(std::move(batch[i]))) {
+                    readJobs.close();
+                    return;
+                }
+                continue;
+            }
+
+            if (pageCount > 1)
+                Log(log_Debug, "loader.cpp", "read", "         '%s' has %i pages.", batch[i].filename.c_str(), pageCount);
+
+            //the workers read the pages themselves, one at a time
+            pool.release(batch[i].data);
+            batch[i].dataRead = false;
+
+            for (int page = 0; page < max(pageCount, 1); page++) {
+                SampleJob pageJob = batch[i];
+                pageJob.index = index++;
+                pageJob.page = page;
+                if ((page > 0 && !acquirePageSlot()) || !readJobs.push(std::move(pageJob))) {
+                    readJobs.close();
+                    return;
+                }
+            }
+        }
+    }
+
+    readJobs.close();
+}
+
+//Runs on a decode worker
+bool SampleLoader::decode(SampleJob &job, Sample &s) {
+
+    s.setTemporaryFolder(mTemporaryFolder);
+
+    if (job.page >= 0) {
+        TraceSpan span("readPage", job.filename.c_str());
+        MetricTimer timer(metric_IMREAD);
+
+        Mat page;
+        int desiredDimension = (mRescaleMethod != rescale_NONE ? mDesiredDimension : 0);
+        if (readPage(job.filename, job.page, mGrayscale, desiredDimension, mRescaleMethod == rescale_FIT, page) && s.set(page, job.filename, job.label, job.page)) {
+            incrementCounter(counter_SAMPLES_LOADED);
+            return true;
+        }
+        incrementCounter(counter_LOAD_FAILURES);
+        return false;
+    }
+
+    //pages are not cached, they never have their bytes in memory
+    string cacheKey = "";
+    if (mCache != NULL && job.dataRead) {
+        cacheKey = mCache->getKey(job.data);
+        if (mCache->load(cacheKey, job.filename, job.label, s)) {
+            incrementCounter(counter_SAMPLES_LOADED);
+            return true;
+        }
+    }
+
+    //files the reader could not read go through imread, which reports the error
+    bool res;
+    if (job.dataRead)
+        res = s.load(job.filename, job.label, job.data, mDesiredDimension, mRescaleMethod, mGrayscale);
+    else
+        res = s.load(job.filename, job.label, false, mDesiredDimension, mRescaleMethod, mGrayscale);
+
+    s.setCacheKey(cacheKey);
+    return res;
+}
+
+bool SampleLoader::run(string path, bool labelFromFolder, function<void(Sample &)> consumer) {
+
+    TraceSpan span("SampleLoader::run");
+    int64 startTask = getTick();
+
+    int threadCount = getThreads();
+    size_t queueSize = (size_t) (mQueueSize > 0 ? mQueueSize : max(threadCount * 4, mReadDepth * 2));
+
+    BoundedQueue<SampleJob> jobs(queueSize);
+    BoundedQueue<SampleJob> readJobs(queueSize);
+    BufferPool pool(queueSize);
+    BoundedQueue<LoadedSample> results(queueSize);
+
+    //In-flight slots: taken by the feeder for every file, given back when the sample reaches the consumer.
+    //Keeps the reorder buffer below 'queueSize' even when one slow file holds back the ones after it.
+    //The extra pages of a multi-page file take page slots instead: the reader waits for those only while
+    //earlier pages are in flight, never for the files the feeder queued after it (which would deadlock).
+    mutex slotMutex;
+    condition_variable slotReleased;
+    size_t filesInFlight = 0;
+    size_t pagesInFlight = 0;
+    bool aborted = false;
+
+    auto acquireSlot = [&](size_t &inFlight) -> bool {
+        unique_lock<mutex> lock(slotMutex);
+        slotReleased.wait(lock, [&] { return aborted || inFlight < queueSize; });
+        if (aborted)
+            return false;
+        inFlight++;
+        return true;
+    };
+
+    auto releaseSlot = [&](size_t &inFlight) {
+        {
+            lock_guard<mutex> lock(slotMutex);
+            inFlight--;
+        }
+        slotReleased.notify_all();
+    };
+
+    mLoadedCount = 0;
+    mThroughput = 0;
+
+    Log(log_Debug, "loader.cpp", "run", "      Loading samples with %i decode threads (%i reads in flight)...", threadCount, mReadDepth);
+
+    thread feeder([&] {
+        setTraceThreadName("feeder");
+        feed(path, labelFromFolder, jobs, [&] { return acquireSlot(filesInFlight); });
+    });
+
+    thread reader([&] {
+        setTraceThreadName("reader");
+        read(jobs, readJobs, pool, [&] { return acquireSlot(pagesInFlight); });
+    });
+
+    vector<thread> workers;
+    atomic<int> runningWorkers(threadCount);
+    for (int t = 0; t < threadCount; t++) {
+        workers.push_back(thread([&, t] {
+            setTraceThreadName("decoder " + to_string(t + 1));
+            SampleJob job;
+            while (readJobs.pop(job)) {
+                LoadedSample result;
+                result.index = job.index;
+                result.pageSlot = (job.page > 0);
+                decode(job, result.sample);
+                pool.release(job.data);
+                if (!results.push(std::move(result)))
+                    break;
+            }
+            if (runningWorkers.fetch_sub(1) == 1)
+                results.close();
+        }));
+    }
+
+    bool res = true;
+
+    try {
+        //Hands the samples over in feeder order
+        map<long, LoadedSample> pending;
+        long nextIndex = 0;
+        LoadedSample result;
+
+        while (results.pop(result)) {
+            pending[result.index] = result;
+
+            map<long, LoadedSample>::iterator it;
+            while ((it = pending.begin()) != pending.end() && it->first == nextIndex) {
+                consumer(it->second.sample);
+                releaseSlot(it->second.pageSlot ? pagesInFlight : filesInFlight);
+                pending.erase(it);
+                nextIndex++;
+                mLoadedCount++;
+            }
+        }
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "loader.cpp", "run", "      Error loading samples: %s", e.what());
+        res = false;
+    }
+
+    //Unblocks everybody (only matters if the consumer failed) and waits for the threads
+    {
+        lock_guard<mutex> lock(slotMutex);
+        aborted = true;
+    }
+    slotReleased.notify_all();
+    jobs.close();
+    readJobs.close();
+    results.close();
+
+    feeder.join();
+    reader.join();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    double seconds = getDiff(startTask);
+    mThroughput = (seconds > 0 ? mLoadedCount / seconds : 0);
+
+    Log(log_Debug, "loader.cpp", "run", "      Done. %li samples loaded in %s seconds (%.1f images/sec).", mLoadedCount, getDiffString(startTask).c_str(), mThroughput);
+    return res;
+}
@@ -0,0 +1,86 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Bounded producer/consumer sample loader:
+//
+//   feeder thread  ->  job queue  ->  reader  ->  read queue  ->  N decode workers  ->  result queue  ->  caller
+//
+// The feeder walks a folder (or reads a manifest) and hands out jobs, the
+// workers decode them in parallel and the calling thread receives the samples
+// back in the same order the feeder produced them. At most 'queue size' files
+// are in flight at any time, so memory does not grow with the input size.
+// Once the reader has its bytes, a multi-page file becomes one job per page,
+// so a long document is decoded page by page as the caller consumes it (with
+// at most another 'queue size' pages in flight). The reader takes whatever
+// jobs are waiting (up to the read depth) and reads the files as one batch,
+// see BatchFileReader; the workers decode the bytes with imdecode().
+//
+
+#ifndef DORA_LOADER_H
+#define DORA_LOADER_H
+
+#include <functional>
+#include "../tools/helper.h"
+#include "../tools/queue.h"
+#include "../tools/filereader.h"
+#include "sample.h"
+#include "cache.h"
+
+using namespace std;
+
+struct SampleJob {
+    long        index;
+    string      filename;
+    string      label;
+    int         page;       //zero based page of a multi-page file, -1 for a single image
+    vector<uchar> data;     //encoded file, filled by the reader
+    bool        dataRead;
+};
+
+//A decoded job on its way back to the caller
+struct LoadedSample {
+    long        index;
+    bool        pageSlot;   //holds a page slot instead of a file slot, see run()
+    Sample      sample;
+};
+
+class SampleLoader {
+    int         mThreads;
+    int         mQueueSize;
+    int         mReadDepth;
+    string      mTemporaryFolder;
+    int         mDesiredDimension;
+    enumRescale mRescaleMethod;
+    bool        mGrayscale;
+    SampleCache *mCache;
+    long        mLoadedCount;
+    double      mThroughput;
+
+    void        feed(string path, bool labelFromFolder, BoundedQueue<SampleJob> &jobs, function<bool()> acquireSlot);
+    void        read(BoundedQueue<SampleJob> &jobs, BoundedQueue<SampleJob> &readJobs, BufferPool &pool, function<bool()> acquirePageSlot);
+    bool        decode(SampleJob &job, Sample &s);
+
+public:
+    //Constructors
+    SampleLoader();
+
+    //Methods
+    bool        run(string path, bool labelFromFolder, function<void(Sample &)> consumer);
+
+    //Setters
+    void        setThreads(int threads);
+    void        setQueueSize(int size);
+    void        setReadDepth(int depth);
+    void        setTemporaryFolder(string folder);
+    void        setDecodeHint(int desiredDimension, enumRescale rescaleMethod, bool grayscale);
+    void        setCache(SampleCache *cache);
+
+    //Getters
+    int         getThreads();
+    long        getLoadedCount();
+    double      getThroughput();
+};
+
+bool isManifest(string path);
+
+#endif
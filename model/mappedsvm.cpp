@@ -0,0 +1,241 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include "mappedsvm.h"
+
+MappedSVM::MappedSVM() {
+    clear();
+}
+
+void MappedSVM::clear() {
+
+    //Initialize the internal variables
+    mKernelType = SVM::RBF;
+    mGamma = 1;
+    mCoef0 = 0;
+    mDegree = 0;
+    mSupportVectors.release();
+    mRho.release();
+    mAlpha.release();
+    mIndex.release();
+    mCount.release();
+    mClassLabels.release();
+
+}
+
+bool MappedSVM::isLoaded() {
+    return (!mSupportVectors.empty() && !mClassLabels.empty());
+}
+
+int MappedSVM::getVarCount() {
+    return mSupportVectors.cols;
+}
+
+//Points the weights to the blocks of an open model file, nothing is copied
+bool MappedSVM::set(ModelFileReader &file) {
+
+    clear();
+
+    Mat parameters = file.getMat("svm_parameters");
+    mSupportVectors = file.getMat("svm_vectors");
+    mRho = file.getMat("svm_rho");
+    mAlpha = file.getMat("svm_alpha");
+    mIndex = file.getMat("svm_index");
+    mCount = file.getMat("svm_count");
+    mClassLabels = file.getMat("svm_labels");
+
+    int classCount = (int) mClassLabels.total();
+    int functionCount = classCount * (classCount - 1) / 2;
+
+    bool valid = (parameters.type() == CV_64F && parameters.total() == 4 && mSupportVectors.type() == CV_32F &&
+                  mRho.type() == CV_64F && mAlpha.type() == CV_64F && mIndex.type() == CV_32S &&
+                  mCount.type() == CV_32S && mClassLabels.type() == CV_32S && classCount >= 2 &&
+                  (int) mRho.total() == functionCount && (int) mCount.total() == functionCount &&
+                  mAlpha.total() == mIndex.total());
+
+    if (valid) {
+        //the indexes are used without checks when predicting
+        const int *count = mCount.ptr<int>(0);
+        const int *index = mIndex.ptr<int>(0);
+        size_t total = 0;
+        for (int i = 0; i < functionCount && valid; i++) {
+            valid = (count[i] >= 0);
+            total += count[i];
+        }
+        valid = valid && (total == mIndex.total());
+        for (size_t i = 0; i < mIndex.total() && valid; i++)
+            valid = (index[i] >= 0 && index[i] < mSupportVectors.rows);
+    }
+
+    if (!valid) {
+        Log(log_Error, "mappedsvm.cpp", "set", "      Model file does not hold a valid SVM.");
+        clear();
+        return false;
+    }
+
+    const double *p = parameters.ptr<double>(0);
+    mKernelType = (int) p[0];
+    mGamma = p[1];
+    mCoef0 = p[2];
+    mDegree = p[3];
+
+    return true;
+}
+
+//Same vote as SVM::predict for C_SVC/NU_SVC: every pair of classes has a decision function
+//and the class with most votes wins, the first one on ties
+float MappedSVM::predict(const Mat &sample) {
+
+    CV_Assert(isLoaded() && sample.type() == CV_32F && (int) sample.total() == mSupportVectors.cols);
+
+    Mat row = sample.isContinuous() ? sample : sample.clone();
+    const float *x = row.ptr<float>(0);
+    int varCount = mSupportVectors.cols;
+
+    vector<double> kernel(mSupportVectors.rows);
+    for (int s = 0; s < mSupportVectors.rows; s++) {
+        const float *v = mSupportVectors.ptr<float>(s);
+        double value = 0;
+
+        if (mKernelType == SVM::RBF) {
+            for (int k = 0; k < varCount; k++) {
+                double d = x[k] - v[k];
+                value += d * d;
+            }
+            value = exp(-mGamma * value);
+        } else {
+            for (int k = 0; k < varCount; k++)
+                value += (double) x[k] * v[k];
+            if (mKernelType == SVM::POLY)
+                value = pow(mGamma * value + mCoef0, mDegree);
+            else if (mKernelType == SVM::SIGMOID)
+                value = tanh(mGamma * value + mCoef0);
+        }
+
+        kernel[s] = value;
+    }
+
+    int classCount = (int) mClassLabels.total();
+    const double *rho = mRho.ptr<double>(0);
+    const double *alpha = mAlpha.ptr<double>(0);
+    const int *index = mIndex.ptr<int>(0);
+    const int *count = mCount.ptr<int>(0);
+    vector<int> votes(classCount, 0);
+
+    int function = 0;
+    for (int i = 0; i < classCount; i++) {
+        for (int j = i + 1; j < classCount; j++, function++) {
+            double sum = -rho[function];
+            for (int k = 0; k < count[function]; k++)
+                sum += alpha[k] * kernel[index[k]];
+            votes[sum > 0 ? i : j]++;
+            alpha += count[function];
+            index += count[function];
+        }
+    }
+
+    int best = 0;
+    for (int i = 1; i < classCount; i++)
+        if (votes[i] > votes[best])
+            best = i;
+
+    return (float) mClassLabels.ptr<int>(0)[best];
+}
+
+//Reads the weights from the node written by SVM::write (the "opencv_ml_svm" node of a saved SVM)
+bool MappedSVM::convert(const FileNode &node, ModelFileWriter &writer) {
+
+    try {
+        FileNode kernelNode = node["kernel"];
+        string svmType = node["svmType"].isString() ? (string) node["svmType"] : "";
+        int svmTypeId = node["svmType"].isInt() ? (int) node["svmType"] : -1;
+        string kernelName = kernelNode["type"].isString() ? (string) kernelNode["type"] : "";
+        int kernelType = kernelNode["type"].isInt() ? (int) kernelNode["type"] : -1;
+
+        if (kernelName == "LINEAR") kernelType = SVM::LINEAR;
+        else if (kernelName == "POLY") kernelType = SVM::POLY;
+        else if (kernelName == "RBF") kernelType = SVM::RBF;
+        else if (kernelName == "SIGMOID") kernelType = SVM::SIGMOID;
+
+        if (!(svmType == "C_SVC" || svmType == "NU_SVC" || svmTypeId == SVM::C_SVC || svmTypeId == SVM::NU_SVC) ||
+            !(kernelType == SVM::LINEAR || kernelType == SVM::POLY || kernelType == SVM::RBF || kernelType == SVM::SIGMOID)) {
+            Log(log_Error, "mappedsvm.cpp", "convert", "      Only C_SVC/NU_SVC with LINEAR, POLY, RBF or SIGMOID kernels can be converted.");
+            return false;
+        }
+
+        int varCount = (int) node["var_count"];
+        int classCount = (int) node["class_count"];
+        int functionCount = classCount * (classCount - 1) / 2;
+
+        Mat classLabels;
+        node["class_labels"] >> classLabels;
+        if (classCount < 2 || varCount <= 0 || (int) classLabels.total() != classCount) {
+            Log(log_Error, "mappedsvm.cpp", "convert", "      SVM has no class labels.");
+            return false;
+        }
+        classLabels = classLabels.reshape(1, 1);
+        classLabels.convertTo(classLabels, CV_32S);
+
+        FileNode vectorsNode = node["support_vectors"];
+        Mat supportVectors((int) vectorsNode.size(), varCount, CV_32F);
+        int r = 0;
+        for (FileNodeIterator it = vectorsNode.begin(); it != vectorsNode.end(); ++it, r++) {
+            vector<float> values;
+            (*it) >> values;
+            if ((int) values.size() != varCount) {
+                Log(log_Error, "mappedsvm.cpp", "convert", "      Support vector %i has %i values, expected %i.", r, (int) values.size(), varCount);
+                return false;
+            }
+            memcpy(supportVectors.ptr<float>(r), values.data(), varCount * sizeof(float));
+        }
+
+        FileNode functionsNode = node["decision_functions"];
+        if ((int) functionsNode.size() != functionCount) {
+            Log(log_Error, "mappedsvm.cpp", "convert", "      SVM has %i decision functions, expected %i.", (int) functionsNode.size(), functionCount);
+            return false;
+        }
+
+        Mat rho(1, functionCount, CV_64F), count(1, functionCount, CV_32S);
+        vector<double> alpha;
+        vector<int> index;
+        int f = 0;
+        for (FileNodeIterator it = functionsNode.begin(); it != functionsNode.end(); ++it, f++) {
+            FileNode function = *it;
+            vector<double> a;
+            vector<int> idx;
+            function["alpha"] >> a;
+            function["index"] >> idx;
+            if (idx.empty())
+                for (int i = 0; i < supportVectors.rows; i++)
+                    idx.push_back(i);
+
+            if (a.size() != idx.size()) {
+                Log(log_Error, "mappedsvm.cpp", "convert", "      Decision function %i is not valid.", f);
+                return false;
+            }
+
+            rho.at<double>(f) = (double) function["rho"];
+            count.at<int>(f) = (int) a.size();
+            alpha.insert(alpha.end(), a.begin(), a.end());
+            index.insert(index.end(), idx.begin(), idx.end());
+        }
+
+        Mat parameters = (Mat_<double>(1, 4) << kernelType,
+                (double) kernelNode["gamma"], (double) kernelNode["coef0"], (double) kernelNode["degree"]);
+
+        writer.addMat("svm_parameters", parameters);
+        writer.addMat("svm_vectors", supportVectors);
+        writer.addMat("svm_rho", rho);
+        writer.addMat("svm_alpha", Mat(alpha).reshape(1, 1));
+        writer.addMat("svm_index", Mat(index).reshape(1, 1));
+        writer.addMat("svm_count", count);
+        writer.addMat("svm_labels", classLabels);
+
+        return true;
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "mappedsvm.cpp", "convert", "      Error converting the SVM: %s", e.what());
+    }
+
+    return false;
+}
@@ -0,0 +1,50 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// One-vs-one C_SVC prediction straight from the blocks of a model file.
+// The support vectors and the decision functions stay in the mapped file,
+// prediction only allocates the kernel values and the votes.
+//
+// The weights come from the regular OpenCV SVM YAML (see convert), so a model
+// gives the same labels through Ptr<SVM>::predict and through this class.
+//
+
+#ifndef DORA_MAPPEDSVM_H
+#define DORA_MAPPEDSVM_H
+
+#include <opencv2/ml.hpp>
+#include "../tools/helper.h"
+#include "modelfile.h"
+
+using namespace std;
+using namespace cv;
+using namespace ml;
+
+class MappedSVM {
+    int     mKernelType;
+    double  mGamma;
+    double  mCoef0;
+    double  mDegree;
+    Mat     mSupportVectors;    //CV_32F, one row per vector
+    Mat     mRho;               //CV_64F, one per decision function
+    Mat     mAlpha;             //CV_64F, all decision functions concatenated
+    Mat     mIndex;             //CV_32S, support vector of each alpha
+    Mat     mCount;             //CV_32S, alphas of each decision function
+    Mat     mClassLabels;       //CV_32S
+
+public:
+    //Constructors
+    MappedSVM();
+
+    //Methods
+    bool            set(ModelFileReader &file);
+    void            clear();
+    float           predict(const Mat &sample);
+    static bool     convert(const FileNode &node, ModelFileWriter &writer);
+
+    //Getters
+    bool            isLoaded();
+    int             getVarCount();
+};
+
+#endif
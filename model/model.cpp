@@ -1,12 +1,23 @@
 //
 // Guttemberg Machado on 24/07/17.
 //
+#include <map>
+#include <thread>
+#include <fstream>
 #include "model.h"
 
+#define VIDEO_QUEUE_SIZE    8       //decoded frames waiting to be classified
+
+struct VideoFrame {
+    long    index;
+    double  ms;
+    Mat     frame;
+};
+
 bool Model::create(string sampleFolder){
 
+    TraceSpan span("Model::create");
     int64 startTask = getTick();
-    int64 startSubtask;
     bool res = false;
 
 	try{
@@ -14,18 +25,19 @@ bool Model::create(string sampleFolder){
 
         if(loadTrainingSamples(sampleFolder)){
     
-            if(preProcessSamples()){
+            //Streaming mode pre-processes the samples while they are loaded
+            if(mStreaming || preProcessSamples()){
 
-                if(createDictionary()){
+                //The projection engine has no dictionary, its feature rows go to the SVM as they are
+                bool projection = (mClassifierType == model_PROJECTION);
 
-                    if(prepareTrainingSet()){
+                if(projection ? extractSamples() : createDictionary()){
 
-                        Log(log_Debug, "model.cpp", "create", "   Training the SVM...");
-                        startSubtask = getTick();
-                        res = mSupportVectorMachine->train(mTrainingData, ROW_SAMPLE, mTrainingLabel);  //(ROW_SAMPLE: each training sample is a row of samples; COL_SAMPLE :each training sample occupies a column of samples)
-                        Log(log_Debug, "model.cpp", "create", "      Done. Training took %s seconds.", getDiffString(startSubtask).c_str());
+                    if (!projection)
+                        mWordCounts = Mat::zeros(1, mDictionary.rows, CV_32S);
 
-                    }
+                    if(prepareTrainingSet())
+                        res = trainSVM();
                 }
             }
         }
@@ -45,15 +57,166 @@ bool Model::create(string sampleFolder){
 
 }
 
+//Adds samples (and new classes) to an existing model: the dictionary is kept, only the new samples are encoded,
+//their histograms are appended to the stored training set and the SVM alone is trained again
+bool Model::update(string sampleFolder){
+
+    TraceSpan span("Model::update");
+    int64 startTask = getTick();
+    bool res = false;
+
+    try{
+        Log(log_Error, "model.cpp", "update", "   Updating model...");
+
+        if (!load())
+            return false;
+
+        //The mapped blocks are read only, the dictionary may be refined and the SVM is trained again
+        if (mModelFile.isOpen()) {
+            if (mClassifierType == model_BAG_OF_FEATURES) {
+                mDictionary = mDictionary.clone();
+                mBOWDescriptorExtractor->setVocabulary(mDictionary);
+            }
+            mMappedSVM.clear();
+        }
+
+        if (!loadTrainingSet() || mTrainingData.empty() || mTrainingData.rows != mTrainingLabel.rows) {
+            Log(log_Error, "model.cpp", "update", "      Model has no stored training set (it was created by an older version), it must be created again.");
+            return false;
+        }
+
+        int previousRows = mTrainingData.rows;
+        vector<Class> previousClasses = mClasses;
+
+        if (loadTrainingSamples(sampleFolder)) {
+
+            //Keeps the class indices of the model, new labels are appended
+            vector<Class> loadedClasses;
+            loadedClasses.swap(mClasses);
+            mClasses = previousClasses;
+
+            for (int i = 0; i < loadedClasses.size(); i++) {
+                int k;
+                for (k = 0; k < mClasses.size(); k++)
+                    if (mClasses[k].getLabel() == loadedClasses[i].getLabel())
+                        break;
+
+                if (k == mClasses.size()) {
+                    Log(log_Debug, "model.cpp", "update", "      New class '%s'.", loadedClasses[i].getLabel().c_str());
+                    mClasses.push_back(loadedClasses[i]);
+                } else
+                    mClasses[k].samples = loadedClasses[i].samples;
+            }
+
+            //No new sample with descriptors means there is nothing to add, the stored model is left as it is
+            if ((mStreaming || preProcessSamples()) && extractSamples()) {
+
+                //the projection engine has no dictionary to refine
+                if (!mRefineDictionary || mClassifierType == model_PROJECTION || refineDictionary()) {
+
+                    if (prepareTrainingSet()) {
+
+                        Log(log_Debug, "model.cpp", "update", "      %i samples were added to the %i stored ones.", mTrainingData.rows - previousRows, previousRows);
+                        res = trainSVM();
+                    }
+                }
+            }
+        }
+
+        if(res)
+            Log(log_Debug, "model.cpp", "update", "   Done. Updating model took %s seconds.", getDiffString(startTask).c_str());
+        else
+            Log(log_Error, "model.cpp", "update", "   Done. Updating model failed after %s seconds!", getDiffString(startTask).c_str());
+
+        return res;
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "update",  "   Error updating model: %s", e.what()) ;
+    }
+
+    return false;
+}
+
+//Online (MacQueen) k-means: every new descriptor pulls its nearest word towards it by 1/n, n being the number of
+//descriptors that word has absorbed so far. Words seen by many training descriptors barely move, while sparse words
+//adapt to the new samples. It is an approximation: the new samples keep the histograms they get here, against the
+//words before they moved (like the stored training rows), and only the samples classified later see the moved words.
+//The counts of those assignments are kept, so prepareTrainingSet() neither encodes nor counts the samples again.
+bool Model::refineDictionary(){
+
+    TraceSpan span("Model::refineDictionary");
+    int64 startTask = getTick();
+
+    try{
+        if (mWordCounts.empty() || mWordCounts.cols != mDictionary.rows) {
+            Log(log_Warning, "model.cpp", "refineDictionary", "      Model has no word counts, the dictionary will not be refined.");
+            return true;
+        }
+
+        Log(log_Debug, "model.cpp", "refineDictionary", "      Refining the dictionary with the new descriptors...");
+
+        mBOWDescriptorExtractor->setVocabulary(mDictionary);
+
+        Mat counts = mWordCounts.clone();
+        Mat dictionary = mDictionary.clone();
+        long descriptorCount = 0;
+
+        for (int i = 0; i < mClasses.size(); i++) {
+            for (int k = 0; k < mClasses[i].samples.size(); k++) {
+
+                Sample &s = mClasses[i].samples[k];
+                vector<vector<int> > pointIdxsOfClusters;
+                if (!encodeDescriptors(s, &pointIdxsOfClusters))
+                    continue;
+
+                for (int word = 0; word < pointIdxsOfClusters.size(); word++) {
+                    for (int p = 0; p < pointIdxsOfClusters[word].size(); p++) {
+                        int n = ++counts.at<int>(word);
+                        Mat centroid = dictionary.row(word);
+                        centroid += (s.dic_descriptors.row(pointIdxsOfClusters[word][p]) - centroid) / n;
+                        descriptorCount++;
+                    }
+                }
+            }
+        }
+
+        mDictionary = dictionary;
+        mWordCounts = counts;
+        Log(log_Debug, "model.cpp", "refineDictionary", "      Done. %li descriptors refined the dictionary in %s seconds.", descriptorCount, getDiffString(startTask).c_str());
+        return true;
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "refineDictionary",  "      Error refining dictionary: %s", e.what()) ;
+    }
+
+    return false;
+}
+
 bool Model::load(){
 
+    TraceSpan span("Model::load");
     int64 startTask = getTick();
     int64 startSubtask;
 
     try{
 
         if (isFile(mFilename)){
-            Log(log_Debug, "model.cpp", "load", "   Loading model...");
+
+            //a model can be loaded over another one
+            mClasses.clear();
+            mMappedSVM.clear();
+
+            if (isModelFile(mFilename))
+                return loadBinary();
+
+            //legacy files only hold bag of features models
+            if (mClassifierType != model_BAG_OF_FEATURES) {
+                Log(log_Error, "model.cpp", "load", "      '%s' is a legacy model, it can not be loaded as a %s model.", mFilename.c_str(), getClassifierName().c_str());
+                return false;
+            }
+
+            mModelFile.close();
+            Log(log_Debug, "model.cpp", "load", "   Loading model (legacy YAML files)...");
 
             vector<string> classLabels;
             classLabels.clear();
@@ -107,6 +270,136 @@ bool Model::load(){
     return false;
 }
 
+//Maps a model bundle written by save or convert. The vocabulary and the SVM weights are used in place,
+//and the pipeline configuration stored with them replaces the current one. Projection models have no
+//vocabulary, their SVM takes the projection feature rows.
+bool Model::loadBinary(){
+
+    TraceSpan span("Model::loadBinary");
+    int64 startTask = getTick();
+
+    try{
+        Log(log_Debug, "model.cpp", "loadBinary", "   Loading binary model '%s'...", mFilename.c_str());
+
+        //open() unmaps the file loaded before, nothing may point into it any more (even if this one fails)
+        mDictionary.release();
+        if (!mBOWDescriptorExtractor.empty())
+            mBOWDescriptorExtractor->setVocabulary(Mat());
+        mMappedSVM.clear();
+
+        if (!mModelFile.open(mFilename))
+            return false;
+
+        if (mModelFile.getVersion() > MODELFILE_VERSION) {
+            Log(log_Error, "model.cpp", "loadBinary", "      Model file version %u is not supported.", mModelFile.getVersion());
+            mModelFile.close();
+            return false;
+        }
+
+        //version 1 files have no configuration, the current one is kept
+        Mat config = mModelFile.getMat("config");
+        if (!config.empty() && !setConfig(config)) {
+            mModelFile.close();
+            return false;
+        }
+
+        mDictionary = mModelFile.getMat("vocabulary");
+        vector<string> labels = mModelFile.getStrings("labels");
+
+        bool projection = (mClassifierType == model_PROJECTION);
+        int varCount = (projection ? getProjectionFeatureLength(mProjectionBins, mProjectionBands) : mDictionary.rows);
+
+        if ((!projection && (mDictionary.empty() || mDictionary.type() != CV_32F)) || labels.empty() || !mMappedSVM.set(mModelFile) ||
+            mMappedSVM.getVarCount() != varCount) {
+            Log(log_Error, "model.cpp", "loadBinary", "      Model file is incomplete.");
+            mDictionary.release();
+            mMappedSVM.clear();
+            mModelFile.close();
+            return false;
+        }
+
+        for (size_t i = 0; i < labels.size(); i++) {
+            Class c;
+            c.setLabel(labels[i]);
+            mClasses.push_back(c);
+        }
+
+        if (!projection)
+            mBOWDescriptorExtractor->setVocabulary(mDictionary);
+        Log(log_Debug, "model.cpp", "loadBinary", "         Model has %i items...", mMappedSVM.getVarCount());
+
+        Log(log_Debug, "model.cpp", "loadBinary", "      Done. Loading model took %s seconds.", getDiffString(startTask).c_str());
+        return true;
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "loadBinary", "      Failed to load model: %s", e.what() ) ;
+    }
+
+    mModelFile.close();
+    return false;
+}
+
+//Writes a legacy YAML pair (mFilename and its dictionary.yml) as a model bundle. The YAML files hold no
+//pipeline configuration, the bundle gets the current one (the one the legacy models were created with).
+bool Model::convert(string binaryFilename){
+
+    int64 startTask = getTick();
+
+    Log(log_Debug, "model.cpp", "convert", "   Converting model '%s' to '%s'...", mFilename.c_str(), binaryFilename.c_str());
+
+    try{
+
+        if (!isFile(mFilename) || isModelFile(mFilename)) {
+            Log(log_Error, "model.cpp", "convert", "      '%s' is not a YAML model file.", mFilename.c_str());
+            return false;
+        }
+
+        Mat dictionary;
+        vector<string> labels;
+
+        string auxFile = getFolderName(mFilename) + "/dictionary.yml";
+        FileStorage fs(auxFile.c_str(), FileStorage::READ);
+        fs["dictionary"] >> dictionary;
+        fs["training_data"] >> mTrainingData;
+        fs["training_label"] >> mTrainingLabel;
+        fs["word_counts"] >> mWordCounts;
+        for (int i = 0; ; i++) {
+            string buffer;
+            fs["class" + to_string(i)] >> buffer;
+            if (buffer.length() == 0)
+                break;
+            labels.push_back(buffer);
+        }
+        fs.release();
+
+        if (dictionary.empty() || dictionary.type() != CV_32F || labels.empty()) {
+            Log(log_Error, "model.cpp", "convert", "      Aux file '%s' has no dictionary or labels.", auxFile.c_str());
+            return false;
+        }
+
+        FileStorage model(mFilename.c_str(), FileStorage::READ);
+        FileNode node = model["opencv_ml_svm"];
+        if (node.empty())
+            node = model.getFirstTopLevelNode();
+        bool res = writeBundle(binaryFilename, dictionary, labels, node);
+        model.release();
+
+        //models created before the training set was stored cannot be updated, converted or not
+        if (res && !mTrainingData.empty())
+            res = writeTrainingSet(binaryFilename);
+
+        if (res) {
+            Log(log_Debug, "model.cpp", "convert", "      Done. Converting model took %s seconds.", getDiffString(startTask).c_str());
+            return true;
+        }
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "convert", "      Failed to convert model: %s", e.what() ) ;
+    }
+
+    return false;
+}
+
 bool Model::save(){
 
     int64 startTask = getTick();
@@ -120,24 +413,28 @@ bool Model::save(){
 
         vector<string> classLabels;
         classLabels.clear();
+        for (int i = 0; i < mClasses.size(); i++)
+            classLabels.push_back(mClasses[i].getLabel());
 
-        string auxFile = getFolderName(mFilename) + "/dictionary.yml";
-        Log(log_Debug, "model.cpp", "save", "      Saving aux file '%s'...", auxFile.c_str() );
-        FileStorage fs(auxFile.c_str(), FileStorage::WRITE);
-        fs << "dictionary" << mDictionary;
-        for (int i = 0; i < mClasses.size(); i++) {
-            fs << "class" + to_string(i) << mClasses[i].getLabel();
-        };
-        fs.release();
-        Log(log_Debug, "model.cpp", "save", "         Done saving aux data in %s seconds.",  getDiffString(startSubtask).c_str());
+        //The SVM weights are taken from its own serialization, the same one convert reads from legacy files
+        FileStorage fs(".yml", FileStorage::WRITE | FileStorage::MEMORY);
+        fs << mSupportVectorMachine->getDefaultName() << "{";
+        mSupportVectorMachine->write(fs);
+        fs << "}";
+        FileStorage svm(fs.releaseAndGetString(), FileStorage::READ | FileStorage::MEMORY);
 
-        startSubtask = getTick();
         Log(log_Debug, "model.cpp", "save", "      Saving model to file '%s'...",  mFilename.c_str());
-        mSupportVectorMachine->save(mFilename.c_str());
+        bool res = writeBundle(mFilename, mDictionary, classLabels, svm[mSupportVectorMachine->getDefaultName()]);
+        svm.release();
         Log(log_Debug, "model.cpp", "save", "         Done saving model took %s seconds.",  getDiffString(startSubtask).c_str());
 
-        Log(log_Debug, "model.cpp", "save", "      Done. Saving files took %s seconds.",  getDiffString(startSubtask).c_str());
-		return true;
+        //kept for '-u': new samples are appended to this training set
+        startSubtask = getTick();
+        res = res && writeTrainingSet(mFilename);
+        Log(log_Debug, "model.cpp", "save", "         Done saving training set in %s seconds.",  getDiffString(startSubtask).c_str());
+
+        Log(log_Debug, "model.cpp", "save", "      Done. Saving files took %s seconds.",  getDiffString(startTask).c_str());
+		return res;
 
 	}catch(const std::exception& e){
 		Log(log_Error, "model.cpp", "save", "      Failed to save model: %s", e.what() ) ;
@@ -146,6 +443,112 @@ bool Model::save(){
 	return false;
 }
 
+//Vocabulary, labels, SVM and the pipeline configuration in one file (see modelfile.h). Projection models have
+//no vocabulary block.
+bool Model::writeBundle(string filename, const Mat &dictionary, const vector<string> &labels, const FileNode &svm){
+
+    ModelFileWriter writer;
+
+    writer.addMat("config", getConfig());
+    if (!dictionary.empty())
+        writer.addMat("vocabulary", dictionary);
+    writer.addStrings("labels", labels);
+
+    return MappedSVM::convert(svm, writer) && writer.write(filename);
+}
+
+//The training set is only read by '-u', it lives next to the bundle so loading a model does not pay for it
+bool Model::writeTrainingSet(string filename){
+
+    ModelFileWriter writer;
+
+    writer.addMat("training_data", mTrainingData);
+    writer.addMat("training_label", mTrainingLabel);
+    writer.addMat("word_counts", mWordCounts);
+
+    Log(log_Debug, "model.cpp", "writeTrainingSet", "      Saving training set to '%s'...", (filename + ".training").c_str());
+    return writer.write(filename + ".training");
+}
+
+//Falls back to the dictionary.yml shared by the legacy models of a folder
+bool Model::loadTrainingSet(){
+
+    int64 startTask = getTick();
+
+    try{
+        string trainingFile = mFilename + ".training";
+
+        if (isFile(trainingFile)) {
+            Log(log_Debug, "model.cpp", "loadTrainingSet", "      Loading training set from '%s'...", trainingFile.c_str());
+            ModelFileReader file;
+            if (!file.open(trainingFile))
+                return false;
+            mTrainingData = file.getMat("training_data").clone();
+            mTrainingLabel = file.getMat("training_label").clone();
+            mWordCounts = file.getMat("word_counts").clone();
+        } else {
+            string auxFile = getFolderName(mFilename) + "/dictionary.yml";
+            Log(log_Debug, "model.cpp", "loadTrainingSet", "      Loading training set from '%s'...", auxFile.c_str());
+            FileStorage fs(auxFile.c_str(), FileStorage::READ);
+            fs["training_data"] >> mTrainingData;
+            fs["training_label"] >> mTrainingLabel;
+            fs["word_counts"] >> mWordCounts;
+            fs.release();
+        }
+
+        Log(log_Debug, "model.cpp", "loadTrainingSet", "         Done. %i stored samples loaded in %s seconds.", mTrainingData.rows, getDiffString(startTask).c_str());
+        return true;
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "loadTrainingSet", "      Failed to load training set: %s", e.what() ) ;
+    }
+
+    return false;
+}
+
+//classifier, feature, matcher, binarization, rescale, sample dimension, dictionary size, projection bins and bands
+Mat Model::getConfig(){
+    return (Mat_<int>(1, 9) << mClassifierType, mFeatureType, mMatcherType, mBinarizationType, mRescaleType,
+            mSampleDimension, mDictionarySize, mProjectionBins, mProjectionBands);
+}
+
+//Engines are created again only when the stored configuration needs different ones. Configurations written
+//before the projection engine have 7 values, the projection settings are kept.
+bool Model::setConfig(const Mat &config){
+
+    bool valid = (config.type() == CV_32S && (config.total() == 7 || config.total() == 9));
+    const int *c = (valid ? config.ptr<int>(0) : NULL);
+    if (valid && config.total() == 9)
+        valid = (c[7] > 0 && c[8] >= 0);
+
+    if (!valid) {
+        Log(log_Error, "model.cpp", "setConfig", "      Model configuration is not valid.");
+        return false;
+    }
+
+    bool engines = (mClassifierType != c[0] || mFeatureType != c[1] || mMatcherType != c[2] || mDictionarySize != c[6]);
+
+    mClassifierType = (enumClassifier) c[0];
+    mFeatureType = (enumFeature) c[1];
+    mMatcherType = (enumMatcher) c[2];
+    mBinarizationType = (enumBinarization) c[3];
+    mRescaleType = (enumRescale) c[4];
+    mSampleDimension = c[5];
+    mDictionarySize = c[6];
+    if (config.total() == 9) {
+        mProjectionBins = c[7];
+        mProjectionBands = c[8];
+    }
+
+    Log(log_Debug, "model.cpp", "setConfig", "      Model configuration: %s, %s, %s, %s, %s, dimension %i, %i words.",
+        getClassifierName().c_str(), getFeatureName().c_str(), getMatcherName().c_str(), getBinarizationName().c_str(),
+        getRescaleName().c_str(), mSampleDimension, mDictionarySize);
+    if (mClassifierType == model_PROJECTION)
+        Log(log_Debug, "model.cpp", "setConfig", "      Projection features: %i bins, %i bands.", mProjectionBins, mProjectionBands);
+
+    return (!engines || initialize());
+}
+
 bool Model::initialize(){
 
     int64 startTask = getTick();
@@ -164,44 +567,48 @@ bool Model::initialize(){
         mTrainingData  = Mat(0,mDictionarySize, CV_32S);
         mTrainingLabel = Mat(0, 1, CV_32S);
 
-        Log(log_Error, "model.cpp", "initialize", "      Initializing feature detector module: '" + getFeatureName() + "'...");
-        switch (mFeatureType)
-        {
-            case feature_SIFT: {
-                mFeatureDetector =  SiftFeatureDetector::create();      //or makePtr<SiftFeatureDetector>();       //it was (on opencv 2.x): = new SiftFeatureDetector();
-                mDescriptorExtractor = SiftDescriptorExtractor::create();  //or makePtr<SiftDescriptorExtractor>()    //it was (on opencv 2.x): = new SiftDescriptorExtractor();
-                Log(log_Error, "model.cpp", "initialize", "         Done.");
+        //The projection engine reads the binary mat itself, it needs no feature detector nor matcher
+        if (mClassifierType == model_BAG_OF_FEATURES) {
 
-                break;
+            Log(log_Error, "model.cpp", "initialize", "      Initializing feature detector module: '" + getFeatureName() + "'...");
+            switch (mFeatureType)
+            {
+                case feature_SIFT: {
+                    mFeatureDetector =  SiftFeatureDetector::create();      //or makePtr<SiftFeatureDetector>();       //it was (on opencv 2.x): = new SiftFeatureDetector();
+                    mDescriptorExtractor = SiftDescriptorExtractor::create();  //or makePtr<SiftDescriptorExtractor>()    //it was (on opencv 2.x): = new SiftDescriptorExtractor();
+                    Log(log_Error, "model.cpp", "initialize", "         Done.");
+
+                    break;
+                }
+                case feature_SURF:
+                case feature_ORB:
+                case feature_LBP:
+                case feature_FAST:
+                case feature_BRIEF:
+                case feature_START:
+                case feature_MSER:
+                case feature_GFTT:
+                case feature_HARRIS:
+                case feature_DENSE:
+                case feature_BLOB:
+                    Log(log_Error, "model.cpp", "initialize", "         ERROR: FEATURE NOT IMPLEMENTED.");
+                    return false;
             }
-            case feature_SURF:
-            case feature_ORB:
-            case feature_LBP:
-            case feature_FAST:
-            case feature_BRIEF:
-            case feature_START:
-            case feature_MSER:
-            case feature_GFTT:
-            case feature_HARRIS:
-            case feature_DENSE:
-            case feature_BLOB:
-                Log(log_Error, "model.cpp", "initialize", "         ERROR: FEATURE NOT IMPLEMENTED.");
-                return false;
-        }
 
-        Log(log_Error, "model.cpp", "initialize", "      Initializing matcher module: '" + getMatcherName() + "'...");
-        switch (mMatcherType)
-        {
-            case matcher_FLANN: {
-                mDescriptorMatcher = new FlannBasedMatcher();
-                Log(log_Error, "model.cpp", "initialize", "         Done.");
-                break;
+            Log(log_Error, "model.cpp", "initialize", "      Initializing matcher module: '" + getMatcherName() + "'...");
+            switch (mMatcherType)
+            {
+                case matcher_FLANN: {
+                    mDescriptorMatcher = new FlannBasedMatcher();
+                    Log(log_Error, "model.cpp", "initialize", "         Done.");
+                    break;
+                }
+                case matcher_K_MEANS_CLUSTERING:
+                case matcher_BRUTE_FORCE:
+                    //mDescriptorMatcher matcher = new BFMatcher::create("BruteForce");
+                    Log(log_Error, "model.cpp", "initialize", "         ERROR: MATCHER NOT IMPLEMENTED.");
+                    return false;
             }
-            case matcher_K_MEANS_CLUSTERING:
-            case matcher_BRUTE_FORCE:
-                //mDescriptorMatcher matcher = new BFMatcher::create("BruteForce");
-                Log(log_Error, "model.cpp", "initialize", "         ERROR: MATCHER NOT IMPLEMENTED.");
-                return false;
         }
 
         Log(log_Error, "model.cpp", "initialize", "      Initializing classifier module: '" + getClassifierName() + "'...");
@@ -218,8 +625,10 @@ bool Model::initialize(){
                 break;
             }
             case model_PROJECTION:{
-                Log(log_Error, "model.cpp", "initialize", "         ERROR: CLASSIFIER NOT IMPLEMENTED.");
-                return false;
+                Log(log_Error, "model.cpp", "initialize", "         Projection features: %i bins, %i bands (%i values per sample).",
+                    mProjectionBins, mProjectionBands, getProjectionFeatureLength(mProjectionBins, mProjectionBands));
+                Log(log_Error, "model.cpp", "initialize", "         Done.");
+                break;
             }
 
         }
@@ -237,6 +646,7 @@ bool Model::initialize(){
         mSupportVectorMachine->setType(SVM::C_SVC);
         Log(log_Error, "model.cpp", "initialize", "         Type: SVC");
 
+        //the projection engine sets it from its training data (see trainSVM)
         mSupportVectorMachine->setGamma(0.50625000000000009);
         Log(log_Error, "model.cpp", "initialize", "         Gamma: 0.50625000000000009");
 
@@ -259,24 +669,63 @@ bool Model::initialize(){
 
 bool Model::loadTrainingSamples(string sampleFolder) {
 
+    TraceSpan span("Model::loadTrainingSamples");
     int64 startTask = getTick();
 
     try{
-        //Is the input folder actually an existing folder?
-        if(isFolder(sampleFolder)) {
+        //Is the input folder actually an existing folder (or a manifest file)?
+        if(isFolder(sampleFolder) || (isFile(sampleFolder) && isManifest(sampleFolder))) {
             
-            //Load all files recursivelly
-            vector<string> files = listFiles(sampleFolder);
-  
             Log(log_Debug, "model.cpp", "loadTrainingSamples", "      Loading samples...");
 
             mClasses.clear();
 
-            //Iterate all files
-            for (int i = 0; i < files.size(); i++) {
+            //Files are decoded by the loader threads and handed back here in listing order
+            SampleLoader loader;
+            loader.setThreads(mLoaderThreads);
+            loader.setReadDepth(mReadDepth);
+            loader.setTemporaryFolder(mTempFolder);
+            if (mReducedDecode)
+                loader.setDecodeHint(mSampleDimension, mRescaleType, true);
+
+            //Cached samples skip decoding, pre-processing and feature extraction. Every setting that changes
+            //the binary mat or the descriptors is part of the key.
+            if (mCache.isEnabled()) {
+                string parameters = format("rescale=%i;dimension=%i;binarization=%i;feature=%i;reduced=%i",
+                                           mRescaleType, mSampleDimension, mBinarizationType, mFeatureType, (mReducedDecode ? 1 : 0));
+                //projection samples keep their feature row as the descriptors
+                if (mClassifierType == model_PROJECTION)
+                    parameters += format(";projection=%ix%i", mProjectionBins, mProjectionBands);
+                mCache.setParameters(parameters);
+                mCache.resetCounters();
+                loader.setCache(&mCache);
+            }
+
+            long streamedCount = 0;
+            long validStreamedCount = 0;
+            long sumWidth = 0;
+            long sumHeight = 0;
+
+            bool loaded = loader.run(sampleFolder, true, [&](Sample &s) {
 
-                //creates a class label based on the folder where the file is located
-                string className = replace(getFolderName(files[i]), sampleFolder, "");
+                //the loader labels the sample after the folder where the file is located
+                string className = s.getLabel();
+
+                sumWidth += s.getOriginalSize().width;
+                sumHeight += s.getOriginalSize().height;
+
+                //Streaming mode: load -> pre-process -> extract descriptors -> discard the images.
+                //Only the keypoints and descriptors stay resident.
+                if (mStreaming) {
+                    streamedCount++;
+                    pollMetricsDump();
+                    Log(log_Debug, "model.cpp", "loadTrainingSamples", "         Streaming sample %05d...", streamedCount);
+
+                    if (s.isCached() || (s.preProcess(mSampleDimension, mRescaleType, mBinarizationType) && extractDescriptors(s)))
+                        validStreamedCount++;
+
+                    s.releaseImages();
+                }
 
                 //Searches for this class
                 int k;
@@ -294,17 +743,18 @@ bool Model::loadTrainingSamples(string sampleFolder) {
                     mClasses.push_back(c);
                 }
 
-                //creates the sample
-                Sample s;
-                s.load(files[i], className, false);
-                s.setTemporaryFolder(mTempFolder) ;
-
                 //adds this sample to the class
                 mClasses[k].samples.push_back(s);
+            });
 
-            }
+            if (!loaded)
+                return false;
 
-            Log(log_Debug, "model.cpp", "loadTrainingSamples", "         %i samples loaded.", files.size());
+            long fileCount = loader.getLoadedCount();
+
+            Log(log_Debug, "model.cpp", "loadTrainingSamples", "         %i samples loaded (%.1f images/sec).", fileCount, loader.getThroughput());
+            if (mCache.isEnabled())
+                Log(log_Debug, "model.cpp", "loadTrainingSamples", "         %li samples were found in the cache, %li were not.", mCache.getHits(), mCache.getMisses());
             Log(log_Debug, "model.cpp", "loadTrainingSamples", "         %i classes found:", mClasses.size());
 
             int averageSampleWidth = 0;
@@ -316,18 +766,17 @@ bool Model::loadTrainingSamples(string sampleFolder) {
                 mClasses[i].calculateAverageSampleWidth();
 
                 Log(log_Debug, "model.cpp", "loadTrainingSamples", "            %i) class '%s' (Average size is W:%i x H:%i)", (i + 1), mClasses[i].getLabel().c_str(), mClasses[i].getAverageSampleWidth(), mClasses[i].getAverageSampleHeight());
-                for (int k = 0; k < mClasses[i].samples.size(); k++) {
-                    averageSampleWidth = averageSampleWidth + mClasses[i].samples[k].originalMat.cols;
-                    averageSampleHeight = averageSampleHeight + mClasses[i].samples[k].originalMat.rows;
-                }
             }
-            if (files.size() > 0) {
-                averageSampleWidth = averageSampleWidth / files.size();
-                averageSampleHeight = averageSampleHeight / files.size();
+            if (fileCount > 0) {
+                averageSampleWidth = (int) (sumWidth / fileCount);
+                averageSampleHeight = (int) (sumHeight / fileCount);
                 Log(log_Debug, "model.cpp", "loadTrainingSamples", "         Average sample size is W:%i x H:%i.", averageSampleWidth, averageSampleHeight);
                 Log(log_Debug, "model.cpp", "loadTrainingSamples", "         Average dimension is %i (sample dimension is set to %i).", (averageSampleWidth + averageSampleHeight) / 2, mSampleDimension);
             }
 
+            if (mStreaming)
+                Log(log_Error, "model.cpp", "loadTrainingSamples", "      %i of %i streamed samples were valid.", validStreamedCount, streamedCount);
+
             Log(log_Debug, "model.cpp", "loadTrainingSamples", "      Done. Loading samples took %s seconds.", getDiffString(startTask).c_str());
             return true;
 
@@ -344,6 +793,7 @@ bool Model::loadTrainingSamples(string sampleFolder) {
 
 bool Model::preProcessSamples() {
 
+    TraceSpan span("Model::preProcessSamples");
     int64 startTask = getTick();
 
     long sampleCount = 0;
@@ -357,10 +807,13 @@ bool Model::preProcessSamples() {
             for (int k = 0; k < mClasses[i].samples.size(); k++) {
 
                 sampleCount++;
+                pollMetricsDump();
 
                 Log(log_Debug, "model.cpp", "preProcessSamples", "         Pre-processing sample %05d...", sampleCount);
   
-                if(mClasses[i].samples[k].preProcess(mSampleDimension, mRescaleType, mBinarizationType))
+                //samples from the cache are already pre-processed
+                Sample &s = mClasses[i].samples[k];
+                if(s.isCached() || s.preProcess(mSampleDimension, mRescaleType, mBinarizationType))
                     validSampleCount++;
 
             }
@@ -376,8 +829,50 @@ bool Model::preProcessSamples() {
     return false;
 }
 
+//Extracts the descriptors of the samples that have none yet (streamed and cached samples already have theirs)
+bool Model::extractSamples() {
+
+    TraceSpan span("Model::extractSamples");
+    int64 startTask = getTick();
+
+    long sampleCount = 0;
+    long validSampleCount = 0;
+
+    try{
+        Log(log_Debug, "model.cpp", "extractSamples", "      Extracting descriptors from the samples...");
+
+        for (int i = 0; i < mClasses.size(); i++) {
+            for (int k = 0; k < mClasses[i].samples.size(); k++) {
+
+                Sample &s = mClasses[i].samples[k];
+                if (s.dic_descriptors.empty() && isMatValid(s.binaryMat)) {
+                    sampleCount++;
+                    pollMetricsDump();
+                    Log(log_Debug, "model.cpp", "extractSamples", "         Processing sample %05d...", sampleCount);
+                    extractDescriptors(s);
+                }
+
+                if (!s.dic_descriptors.empty())
+                    validSampleCount++;
+            }
+        }
+
+        Log(log_Debug, "model.cpp", "extractSamples", "         Done. %li samples have descriptors. Extracting descriptors took %s seconds.", validSampleCount, getDiffString(startTask).c_str());
+        if (mCache.isEnabled())
+            Log(log_Debug, "model.cpp", "extractSamples", "         %li samples were added to the cache.", mCache.getStores());
+
+        return (validSampleCount > 0);
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "extractSamples",  "      Error extracting descriptors: %s", e.what()) ;
+    }
+
+    return false;
+}
+
 bool Model::createDictionary() {
 
+    TraceSpan span("Model::createDictionary");
     int64 startTask = getTick();
     int64 startSubtask;
 
@@ -392,37 +887,39 @@ bool Model::createDictionary() {
 
             for (int k = 0; k < mClasses[i].samples.size(); k++) {
 
-                Mat m = mClasses[i].samples[k].binaryMat;
-                if (isMatValid(m)) {
+                Sample &s = mClasses[i].samples[k];
+
+                //Streaming mode has already extracted the descriptors (and released the images)
+                if (s.dic_descriptors.empty() && isMatValid(s.binaryMat)) {
 
                     sampleCount++;
+                    pollMetricsDump();
                     Log(log_Debug, "model.cpp", "createDictionary", "         Processing sample %05d...", sampleCount);
 
-                    Log(log_Detail, "model.cpp", "createDictionary", "            Extracting features...");
-                    mFeatureDetector->detect(m, mClasses[i].samples[k].features);
-                    if (mClasses[i].samples[k].features.size() > 0) {
-                        Log(log_Detail, "model.cpp", "createDictionary","               Computing descriptors from the %i extracted features...", mClasses[i].samples[k].features.size());
-                        mDescriptorExtractor->compute(m, mClasses[i].samples[k].features,  mClasses[i].samples[k].dic_descriptors);
-                        if (!mClasses[i].samples[k].dic_descriptors.empty()) {
-                            validSampleCount++;
-                            Log(log_Detail, "model.cpp", "createDictionary","                  Adding descriptors to Trainer...");
-                            mTrainer->add(mClasses[i].samples[k].dic_descriptors);
-                            Log(log_Detail, "model.cpp", "createDictionary","                     Done. Trainer has %i descriptors.", mTrainer->descriptorsCount());
-                        } else
-                            Log(log_Error, "model.cpp", "createDictionary","            Ignoring sample because no descriptors were computed.");
-                    } else
-                        Log(log_Error, "model.cpp", "createDictionary","            Ignoring sample because no features were extracted.");
+                    extractDescriptors(s);
+                }
+
+                if (!s.dic_descriptors.empty()) {
+                    validSampleCount++;
+                    Log(log_Detail, "model.cpp", "createDictionary","                  Adding descriptors to Trainer...");
+                    mTrainer->add(s.dic_descriptors);
+                    Log(log_Detail, "model.cpp", "createDictionary","                     Done. Trainer has %i descriptors.", mTrainer->descriptorsCount());
                 }
             }
         }
         Log(log_Debug, "model.cpp", "createDictionary", "         Done. Processing samples took %s seconds.", getDiffString(startSubtask).c_str());
+        if (mCache.isEnabled())
+            Log(log_Debug, "model.cpp", "createDictionary", "         %li samples were added to the cache.", mCache.getStores());
 
         //Did processing the samples find anything usefull?
         if (mTrainer->descriptorsCount() > 0){
 
             startSubtask = getTick();
             Log(log_Debug, "model.cpp", "createDictionary", "      Clustering the %i descriptors from the %i valid samples (choosing centroids as words)...", mTrainer->descriptorsCount(), validSampleCount);
-            mDictionary = mTrainer->cluster();
+            {
+                TraceSpan clusterSpan("BOWKMeansTrainer::cluster");
+                mDictionary = mTrainer->cluster();
+            }
             Log(log_Debug, "model.cpp", "createDictionary", "         Done. Clustering took %s seconds.", getDiffString(startSubtask).c_str());
 
             Log(log_Debug, "model.cpp", "createDictionary", "      Done. Created the dictionary (%i words, %i items) in %s seconds.", mDictionary.rows, mDictionary.cols, getDiffString(startTask).c_str());
@@ -439,8 +936,94 @@ bool Model::createDictionary() {
 
 }
 
+bool Model::extractDescriptors(Sample &s) {
+
+    if (mClassifierType == model_PROJECTION)
+        return extractProjection(s);
+
+    Mat m = s.binaryMat;
+
+    Log(log_Detail, "model.cpp", "extractDescriptors", "            Extracting features...");
+    {
+        TraceSpan detectSpan("detect");
+        MetricTimer timer(metric_DETECT);
+        mFeatureDetector->detect(m, s.features);
+    }
+
+    if (s.features.size() > 0) {
+        Log(log_Detail, "model.cpp", "extractDescriptors","               Computing descriptors from the %i extracted features...", s.features.size());
+        {
+            TraceSpan descriptorSpan("descriptors");
+            MetricTimer timer(metric_DESCRIPTORS);
+            mDescriptorExtractor->compute(m, s.features, s.dic_descriptors);
+        }
+        if (!s.dic_descriptors.empty()) {
+            mCache.store(s);
+            return true;
+        }
+
+        Log(log_Error, "model.cpp", "extractDescriptors","            Ignoring sample because no descriptors were computed.");
+    } else
+        Log(log_Error, "model.cpp", "extractDescriptors","            Ignoring sample because no features were extracted.");
+
+    return false;
+}
+
+//The projection engine descriptor is a single row, the resampled profiles of the binary mat (see getProjectionFeatures).
+//The profiles themselves were computed by preProcess.
+bool Model::extractProjection(Sample &s) {
+
+    Log(log_Detail, "model.cpp", "extractProjection", "            Computing projection features...");
+    {
+        TraceSpan projectionSpan("projection");
+        MetricTimer timer(metric_PROJECTION);
+        getProjectionFeatures(s.binaryMat, s.profile, mProjectionBins, mProjectionBands, s.dic_descriptors);
+    }
+
+    if (!s.dic_descriptors.empty()) {
+        mCache.store(s);
+        return true;
+    }
+
+    Log(log_Error, "model.cpp", "extractProjection","            Ignoring sample because no projection features were computed.");
+    return false;
+}
+
+//Quantizes the descriptors the sample already has (no image, no second SIFT pass). A projection row is
+//the SVM input as it is.
+bool Model::encodeDescriptors(Sample &s, vector<vector<int> > *pointIdxsOfClusters) {
+
+    if (mClassifierType == model_PROJECTION) {
+        s.bow_descriptors = s.dic_descriptors;
+        return !s.bow_descriptors.empty();
+    }
+
+    TraceSpan bowSpan("bow");
+    MetricTimer timer(metric_BOW);
+
+    Log(log_Detail, "model.cpp", "encodeDescriptors", "            Computing the bag of words from the %i descriptors...", s.dic_descriptors.rows);
+
+    if (s.dic_descriptors.empty())
+        return false;
+
+    mBOWDescriptorExtractor->compute(s.dic_descriptors, s.bow_descriptors, pointIdxsOfClusters);
+    return !s.bow_descriptors.empty();
+}
+
+//Returns the index of the predicted class
+float Model::predict(Sample &s) {
+
+    TraceSpan predictSpan("predict");
+    MetricTimer timer(metric_PREDICT);
+
+    float response = mMappedSVM.isLoaded() ? mMappedSVM.predict(s.bow_descriptors) : mSupportVectorMachine->predict(s.bow_descriptors);
+    incrementCounter(counter_PREDICTIONS);
+    return response;
+}
+
 bool Model::prepareTrainingSet() {
 
+    TraceSpan span("Model::prepareTrainingSet");
     int64 startTask = getTick();
     int64 startSubtask;
 
@@ -450,9 +1033,11 @@ bool Model::prepareTrainingSet() {
     try{
         Log(log_Debug, "model.cpp", "prepareTrainingSet", "   Preparing training set...");
 
-        Log(log_Error, "model.cpp", "prepareTrainingSet", "      Setting vocabulary...");
-        mBOWDescriptorExtractor->setVocabulary(mDictionary);
-        Log(log_Error, "model.cpp", "prepareTrainingSet", "         Done.");
+        if (mClassifierType == model_BAG_OF_FEATURES) {
+            Log(log_Error, "model.cpp", "prepareTrainingSet", "      Setting vocabulary...");
+            mBOWDescriptorExtractor->setVocabulary(mDictionary);
+            Log(log_Error, "model.cpp", "prepareTrainingSet", "         Done.");
+        }
 
         Log(log_Error, "model.cpp", "prepareTrainingSet", "      Preparing samples...");
         startSubtask = getTick();
@@ -460,17 +1045,25 @@ bool Model::prepareTrainingSet() {
 
             for (int k = 0; k < mClasses[i].samples.size(); k++) {
 
-                //Check if this sample has the features (saved on createDictionary)
-                if(mClasses[i].samples[k].features.size() > 0){
+                //Check if this sample has the descriptors (saved on createDictionary)
+                if(!mClasses[i].samples[k].dic_descriptors.empty()){
 
                     sampleCount++;
                     Log(log_Error, "model.cpp", "prepareTrainingSet", "         Preparing sample %05d...", sampleCount);
 
-                    Mat m = mClasses[i].samples[k].binaryMat;
-                    Log(log_Detail, "model.cpp", "prepareTrainingSet", "         Computing descriptors from the %i features...", mClasses[i].samples[k].features.size());
-                    mBOWDescriptorExtractor->compute(m, mClasses[i].samples[k].features, mClasses[i].samples[k].bow_descriptors);
+                    //The bag of words is a histogram of the dictionary words nearest to each of the descriptors computed
+                    //on createDictionary (computing it from the image would only run SIFT again on the same keypoints).
+                    //Samples refineDictionary() already encoded and counted keep their histograms.
+                    if (mClasses[i].samples[k].bow_descriptors.empty()) {
+                        vector<vector<int> > pointIdxsOfClusters;
+                        encodeDescriptors(mClasses[i].samples[k], &pointIdxsOfClusters);
+
+                        //word counts are the learning rates of refineDictionary()
+                        if (mWordCounts.cols == (int) pointIdxsOfClusters.size())
+                            for (int word = 0; word < pointIdxsOfClusters.size(); word++)
+                                mWordCounts.at<int>(word) += (int) pointIdxsOfClusters[word].size();
+                    }
 
-                    //TODO: GOTCHA 4: Is the bow_descriptos the same as the dic_descriptors?
                     if (!mClasses[i].samples[k].bow_descriptors.empty()) {
                         validSampleCount++;
                         Log(log_Detail, "model.cpp", "prepareTrainingSet", "            Adding descriptors and label to the training data...");
@@ -494,6 +1087,35 @@ bool Model::prepareTrainingSet() {
 
 }
 
+bool Model::trainSVM() {
+
+    TraceSpan span("SVM::train");
+    int64 startTask = getTick();
+
+    try{
+        //Projection rows are not histograms: the RBF width follows the spread of the training values instead
+        //(gamma = 1 / (values per row * variance)), and it is stored with the SVM
+        if (mClassifierType == model_PROJECTION) {
+            Scalar mean, deviation;
+            meanStdDev(mTrainingData.reshape(1, 1), mean, deviation);
+            double variance = deviation[0] * deviation[0];
+            if (variance > 0)
+                mSupportVectorMachine->setGamma(1.0 / (mTrainingData.cols * variance));
+            Log(log_Debug, "model.cpp", "trainSVM", "      Gamma: %f", mSupportVectorMachine->getGamma());
+        }
+
+        Log(log_Debug, "model.cpp", "trainSVM", "   Training the SVM...");
+        bool res = mSupportVectorMachine->train(mTrainingData, ROW_SAMPLE, mTrainingLabel);  //(ROW_SAMPLE: each training sample is a row of samples; COL_SAMPLE :each training sample occupies a column of samples)
+        Log(log_Debug, "model.cpp", "trainSVM", "      Done. Training took %s seconds.", getDiffString(startTask).c_str());
+        return res;
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "trainSVM",  "      Error training the SVM: %s", e.what()) ;
+    }
+
+    return false;
+}
+
 string Model::getClassifierName(){
     switch (mClassifierType){
         case model_PROJECTION:	    return "PROJECTION";
@@ -580,6 +1202,53 @@ void Model::setTempFolder(string newTempFolder){
     Log(log_Debug, "model.cpp", "setTempFolder", "Temporary folder  was set to '%s'.", mTempFolder.c_str());
 }
 
+void Model::setStreaming(bool streaming) {
+    mStreaming = streaming;
+    Log(log_Debug, "model.cpp", "setStreaming", "Streaming mode was turned %s.", (mStreaming ? "on" : "off"));
+}
+
+void Model::setReducedDecode(bool reducedDecode) {
+    mReducedDecode = reducedDecode;
+    Log(log_Debug, "model.cpp", "setReducedDecode", "Reduced decoding was turned %s.", (mReducedDecode ? "on" : "off"));
+}
+
+void Model::setReadDepth(int depth) {
+    mReadDepth = depth;
+    Log(log_Debug, "model.cpp", "setReadDepth", "Read depth was set to %i.", mReadDepth);
+}
+
+void Model::setCacheFolder(string folder) {
+    mCache.setFolder(folder);
+    Log(log_Debug, "model.cpp", "setCacheFolder", "Sample cache folder was set to '%s'.", folder.c_str());
+}
+
+void Model::setRefineDictionary(bool refine) {
+    mRefineDictionary = refine;
+    Log(log_Debug, "model.cpp", "setRefineDictionary", "Dictionary refinement was turned %s.", (mRefineDictionary ? "on" : "off"));
+}
+
+void Model::setProjectionBands(int bands) {
+    mProjectionBands = max(bands, 0);
+    Log(log_Debug, "model.cpp", "setProjectionBands", "Projection bands were set to %i.", mProjectionBands);
+}
+
+void Model::setFrameStride(int stride) {
+    mFrameStride = max(stride, 1);
+}
+
+void Model::setGateThreshold(double threshold) {
+    mGateThreshold = threshold;
+}
+
+void Model::setSmoothingWindow(int window) {
+    mSmoothingWindow = max(window, 1);
+}
+
+void Model::setLoaderThreads(int threads) {
+    mLoaderThreads = threads;
+    Log(log_Debug, "model.cpp", "setLoaderThreads", "Loader threads were set to %i.", mLoaderThreads);
+}
+
 void Model::setFilename(string filename) {
     mFilename = filename;
     Log(log_Debug, "model.cpp", "setFilename", "Filename was set to '%s'.", mFilename.c_str());
@@ -589,53 +1258,28 @@ string Model::getFilename() {
     return mFilename;
 }
 
-bool Model::loadPredictionSamples(string path) {
+//Samples (or the pages of multi-page files) are handed to the consumer as they are decoded, never kept all at once
+bool Model::loadPredictionSamples(string path, function<void(Sample &)> consumer) {
 
+    TraceSpan span("Model::loadPredictionSamples");
     int64 startTask = getTick();
 
     try{
         Log(log_Debug, "model.cpp", "loadPredictionSamples", "      Loading samples...");
 
-        string folder;
-        vector<string> files;
-        files.clear();
-
-        //Is the input folder actually an existing folder?
-        if(isFolder(path)) {
-            folder = path;
-            files = listFiles(path);
-        }else {
-            if (isFile(path)) {
-                folder = getFolderName(path);
-                files.push_back(path);
-            }
-        }
-
-        if(files.size()==0)
-            Log(log_Debug, "model.cpp", "loadPredictionSamples", "         No files found.");
-        else
-            if(files.size()==1)
-                Log(log_Debug, "model.cpp", "loadPredictionSamples", "         Only one file found:");
-            else
-                Log(log_Debug, "model.cpp", "loadPredictionSamples", "         %i files found:", files.size());
-
-        mPredictionData.clear();
-
-        //Iterate all files
-        for (int i = 0; i < files.size(); i++) {
-
-            Log(log_Detail, "helper.cpp", "loadPredictionSamples", "            Loading sample %05d...", (mPredictionData.size() + 1));
+        //Files are decoded by the loader threads and handed back here in listing order
+        SampleLoader loader;
+        loader.setThreads(mLoaderThreads);
+        loader.setReadDepth(mReadDepth);
+        loader.setTemporaryFolder(mTempFolder);
+        if (mReducedDecode)
+            loader.setDecodeHint(mSampleDimension, mRescaleType, true);
 
-            string label = "Image" + to_string(mPredictionData.size() + 1);
-
-            Sample s;
-            s.load(files[i], label, false);
-            s.setTemporaryFolder(mTempFolder);
-
-            //adds this sample to the prediction data array
-            mPredictionData.push_back(s);
+        if (!loader.run(path, false, consumer))
+            return false;
 
-        }
+        if(loader.getLoadedCount()==0)
+            Log(log_Debug, "model.cpp", "loadPredictionSamples", "         No files found.");
 
         Log(log_Debug, "helper.cpp", "loadPredictionSamples", "         Done. Loading samples took %s seconds.", getDiffString(startTask).c_str());
         return true;
@@ -649,7 +1293,15 @@ bool Model::loadPredictionSamples(string path) {
 }
 
 bool Model::classify(Sample s, string expectedLabel){
+    string predictedLabel;
+    return classify(s, expectedLabel, predictedLabel);
+}
+
+bool Model::classify(Sample s, string expectedLabel, string &predictedLabel){
 
+    predictedLabel = "";
+
+    TraceSpan span("Model::classify", s.getFilename().c_str());
     int64 startTask = getTick();
 
     try{
@@ -657,18 +1309,14 @@ bool Model::classify(Sample s, string expectedLabel){
     
         if(s.preProcess(mSampleDimension, mRescaleType, mBinarizationType)) {
         
-            Log(log_Detail, "model.cpp", "classify", "         Extracting features...");
-            mFeatureDetector->detect(s.binaryMat, s.features);
-        
-            if (s.features.size() > 0) {
-                
-                Log(log_Detail, "model.cpp", "classify", "         Computing descriptors from the %i extracted features...", s.features.size());
-                mBOWDescriptorExtractor->compute(s.binaryMat, s.features, s.bow_descriptors);
+            //SIFT runs once: the bag of words is built from the same descriptors
+            if (extractDescriptors(s)) {
             
-                if (!s.bow_descriptors.empty()) {
+                if (encodeDescriptors(s)) {
                 
-                    Log(log_Detail, "model.cpp", "classify","         Predicting using the %i descriptors ('%s' from file '%s)...", s.bow_descriptors, s.getLabel().c_str(), s.getFilename().c_str());
-                    float response = mSupportVectorMachine->predict(s.bow_descriptors);
+                    Log(log_Detail, "model.cpp", "classify","         Predicting using the %i descriptors ('%s' from file '%s)...", s.bow_descriptors.cols, s.getLabel().c_str(), s.getFilename().c_str());
+                    float response = predict(s);
+                    predictedLabel = mClasses[response].getLabel();
                     
                     if (mClasses[response].getLabel().c_str() == expectedLabel){
                         Log(log_Debug, "model.cpp", "classify","            Success. Dora classified as '%s' (Class of index %1.0f) in %s seconds!", mClasses[response].getLabel().c_str(), response, getDiffString(startTask).c_str());
@@ -688,6 +1336,58 @@ bool Model::classify(Sample s, string expectedLabel){
     return false;
 }
 
+//Pre-processes a camera or video frame and returns the index of the predicted class (-1 when it fails)
+float Model::classifyFrame(Mat frame){
+
+    try{
+        Sample s;
+        s.set(frame);
+
+        if (s.preProcess(mSampleDimension, mRescaleType, mBinarizationType)) {
+
+            if (extractDescriptors(s)) {
+
+                if (encodeDescriptors(s)) {
+
+                    Log(log_Detail, "model.cpp", "classifyFrame","         Predicting using the %i descriptors...", s.bow_descriptors.cols);
+                    return predict(s);
+
+                }else
+                    Log(log_Error, "model.cpp", "classifyFrame", "            Failed to compute descriptions for frame!");
+            }else
+                Log(log_Error, "model.cpp", "classifyFrame", "            Failed to extract features for frame!");
+        }else
+            Log(log_Error, "model.cpp", "classifyFrame", "            Failed to pre-process frame!");
+
+    }catch(const std::exception& e){
+        Log(log_Error, "model.cpp", "classifyFrame",  "            Error classifying frame: %s", e.what()) ;
+    }
+
+    return -1;
+}
+
+//Camera and video frames: the full chain only runs when the scene changed, otherwise the current label is
+//reused. Returns the smoothed class index (-1 while there is none).
+int Model::classifyStreamFrame(Mat frame, FrameGate &gate, LabelSmoother &smoother, bool &reused){
+
+    reused = !gate.hasChanged(frame);
+
+    if (reused) {
+        //every frame votes, so a stable scene outvotes the one before it within the window
+        smoother.repeat();
+        incrementCounter(counter_FRAMES_REUSED);
+    } else {
+        //the gate only moves to this frame once it has a label, otherwise the next frames of the scene reuse the old one
+        float response = classifyFrame(frame);
+        if (response >= 0) {
+            smoother.add((int) response);
+            gate.accept();
+        }
+    }
+
+    return smoother.getLabel();
+}
+
 bool Model::classifyCamera(){
     
     int64 startTask = getTick();
@@ -704,39 +1404,19 @@ bool Model::classifyCamera(){
         }
         
         Mat edges;
+        FrameGate gate(mGateThreshold);
+        LabelSmoother smoother(mSmoothingWindow);
         namedWindow("webcam", WINDOW_NORMAL);
         while(true)
         {
             Mat frame;
             capture >> frame;
-            Sample s;
-            s.set(frame);
-            if (s.preProcess(mSampleDimension, mRescaleType, mBinarizationType)) {
-                 
-                 Log(log_Detail, "model.cpp", "classify", "         Extracting features...");
-                 mFeatureDetector->detect(s.binaryMat, s.features);
-                 
-                 if (s.features.size() > 0) {
-                     
-                     Log(log_Detail, "model.cpp", "classify", "         Computing descriptors from the %i extracted features...", s.features.size());
-                     mBOWDescriptorExtractor->compute(s.binaryMat, s.features, s.bow_descriptors);
-                     
-                     if (!s.bow_descriptors.empty()) {
-                         
-                         Log(log_Detail, "model.cpp", "classify","         Predicting using the %i descriptors ('%s' from file '%s)...", s.bow_descriptors, s.getLabel().c_str(), s.getFilename().c_str());
-                        
-                         Mat receivedResponses;
-                         float response = mSupportVectorMachine->predict(s.bow_descriptors, receivedResponses);
-                         
-                         Log(log_Debug, "model.cpp", "classify","            Current Classification is '%s' (Class of index %1.0f)", mClasses[response].getLabel().c_str(), response, getDiffString(startTask).c_str());
-                         Log(log_Debug, "model.cpp", "classify","            Current Probability is '%s' (Class of index %1.0f)", mClasses[response].getLabel().c_str(), response, getDiffString(startTask).c_str());
-                         
-                     }else
-                         Log(log_Error, "model.cpp", "classify", "            Failed to compute descriptions for file '%s'!", s.getFilename().c_str() );
-                 }else
-                     Log(log_Error, "model.cpp", "classify", "            Failed to extract features for file '%s'!", s.getFilename().c_str() );
-             }else
-                 Log(log_Error, "model.cpp", "classify", "            Failed to pre-process sample file '%s'!", s.getFilename().c_str() );
+            pollMetricsDump();
+            bool reused;
+            int response = classifyStreamFrame(frame, gate, smoother, reused);
+            if (response >= 0 && !reused) {
+                Log(log_Debug, "model.cpp", "classify","            Current Classification is '%s' (Class of index %i)", mClasses[response].getLabel().c_str(), response);
+            }
 
             imshow("webcam", frame);
             
@@ -759,32 +1439,210 @@ bool Model::classifyCamera(){
     return false;
 }
 
-bool Model::test(string path){
+//Grabs every frame but only retrieves (converts) the ones that are classified
+static void decodeVideo(VideoCapture &capture, int stride, BoundedQueue<VideoFrame> &frames){
+
+    long index = 0;
+
+    while (capture.grab()) {
+        if (index % stride == 0) {
+            VideoFrame f;
+            f.index = index;
+            f.ms = capture.get(CAP_PROP_POS_MSEC);
+            if (capture.retrieve(f.frame) && !f.frame.empty() && !frames.push(std::move(f)))
+                break;
+        }
+        index++;
+    }
+
+    frames.close();
+}
+
+static string csvField(string value){
+
+    if (value.find_first_of(",\"\n") == string::npos)
+        return value;
+
+    string res = "\"";
+    for (size_t i = 0; i < value.size(); i++)
+        res += (value[i] == '"' ? "\"\"" : string(1, value[i]));
+    return res + "\"";
+}
+
+//Headless classification of a video file. A decoder thread keeps a few frames ready while this one
+//classifies, and every sampled frame gets a 'frame,ms,label,reused' line in the csv file.
+bool Model::classifyVideo(string videoFilename, string csvFilename){
+
+    TraceSpan span("Model::classifyVideo");
+    int64 startTask = getTick();
+
+    try{
+
+        VideoCapture capture(videoFilename);
+        if(!capture.isOpened()){
+            Log(log_Error, "model.cpp", "classifyVideo", "      Failed to open video file '%s'!", videoFilename.c_str());
+            return false;
+        }
+
+        ofstream csv(csvFilename.c_str(), ios::trunc);
+        if (!csv.is_open()) {
+            Log(log_Error, "model.cpp", "classifyVideo", "      Failed to create csv file '%s'!", csvFilename.c_str());
+            return false;
+        }
+        csv << "frame,ms,label,reused\n";
+
+        double fps = capture.get(CAP_PROP_FPS);
+        Log(log_Debug, "model.cpp", "classifyVideo", "   Classifying video '%s' (%.2f fps, one frame in %i)...", videoFilename.c_str(), fps, mFrameStride);
+
+        BoundedQueue<VideoFrame> frames(VIDEO_QUEUE_SIZE);
+        thread decoder([&] {
+            setTraceThreadName("video decoder");
+            decodeVideo(capture, mFrameStride, frames);
+        });
+
+        //The decoder uses 'capture' and 'frames': it is stopped and joined on every way out, an exception included
+        struct DecoderGuard {
+            BoundedQueue<VideoFrame>   &frames;
+            thread                     &decoder;
+
+            ~DecoderGuard() {
+                frames.close();
+                if (decoder.joinable())
+                    decoder.join();
+            }
+        } decoderGuard = {frames, decoder};
+
+        VideoFrame f;
+        FrameGate gate(mGateThreshold);
+        LabelSmoother smoother(mSmoothingWindow);
+        long frameCount = 0;
+        long reusedCount = 0;
+        double lastMs = 0;
+
+        while (frames.pop(f)) {
+            pollMetricsDump();
+
+            bool reused;
+            int response = classifyStreamFrame(f.frame, gate, smoother, reused);
+            string label = (response >= 0 ? mClasses[response].getLabel() : "");
+            if (reused)
+                reusedCount++;
+
+            csv << f.index << "," << format("%.1f", f.ms) << "," << csvField(label) << "," << (reused ? 1 : 0) << "\n";
+            Log(log_Detail, "model.cpp", "classifyVideo", "      Frame %ld (%.1f ms): '%s'", f.index, f.ms, label.c_str());
+
+            frameCount++;
+            lastMs = f.ms;
+        }
+
+        frames.close();
+        decoder.join();
+        capture.release();
+        csv.close();
+
+        double seconds = getDiff(startTask);
+        Log(log_Debug, "model.cpp", "classifyVideo", "   Done. %ld frames classified (%ld reused the previous label) in %s seconds, %.1fx real time.",
+            frameCount, reusedCount, getDiffString(startTask).c_str(), (seconds > 0 ? lastMs / 1000.0 / seconds : 0));
+
+        return csv.good();
+
+    }catch(const std::exception& e) {
+        Log(log_Error, "model.cpp", "classifyVideo", "   Error classifying video: %s", e.what());
+    }
+
+    return false;
+}
+
+bool Model::test(string path, TestSummary *summary){
     
+    TraceSpan span("Model::test");
     int64 startTask = getTick();
-    int successCount = 0;
+    long successCount = 0;
+    long sampleCount = 0;
+    double classifySeconds = 0;
+
+    //Pages of the multi-page document being classified. The document label is the label most of its pages got.
+    string documentFile = "";
+    string documentExpectedLabel = "";
+    map<string, int> documentVotes;
+    int documentPages = 0;
+    long documentCount = 0;
+    long documentSuccessCount = 0;
+
+    auto closeDocument = [&]() {
+        if (documentPages == 0)
+            return;
+
+        string documentLabel = "";
+        int votes = 0;
+        for (map<string, int>::iterator it = documentVotes.begin(); it != documentVotes.end(); ++it) {
+            if (it->second > votes) {
+                documentLabel = it->first;
+                votes = it->second;
+            }
+        }
+
+        documentCount++;
+        if (documentLabel != "" && documentLabel == documentExpectedLabel)
+            documentSuccessCount++;
+
+        Log(log_Debug, "model.cpp", "test", "         Document '%s' was classified as '%s' (%i of %i pages).", documentFile.c_str(), documentLabel.c_str(), votes, documentPages);
+
+        documentVotes.clear();
+        documentPages = 0;
+    };
     
     try{
         Log(log_Debug, "model.cpp", "test", "   Starting classification tests...");
-        
-        if(loadPredictionSamples(path)){
-            
-            Log(log_Debug, "model.cpp", "test", "      Processing samples...");
-            
-            long sampleCount = 0;
-            
-            for (int i = 0; i < mPredictionData.size(); i++) {
-                
-                sampleCount++;
-                string className = replace(getFolderName(mPredictionData[i].getFilename()), path, "");
-                
-                if(classify(mPredictionData[i], className))
-                    successCount++;
-               
+        Log(log_Debug, "model.cpp", "test", "      Processing samples...");
+
+        bool loaded = loadPredictionSamples(path, [&](Sample &s) {
+
+            sampleCount++;
+            pollMetricsDump();
+            string className = replace(getFolderName(s.getFilename()), path, "");
+
+            //a new file closes the document before it
+            if (s.getFilename() != documentFile) {
+                closeDocument();
+                documentFile = s.getFilename();
+                documentExpectedLabel = className;
             }
+
+            string predictedLabel;
+            int64 startClassify = getTick();
+            if(classify(s, className, predictedLabel))
+                successCount++;
+            classifySeconds += getDiff(startClassify);
+
+            if (s.getPage() >= 0) {
+                Log(log_Debug, "model.cpp", "test", "         Page %i of '%s' was classified as '%s'.", s.getPage() + 1, s.getFilename().c_str(), predictedLabel.c_str());
+                if (predictedLabel != "")
+                    documentVotes[predictedLabel]++;
+                documentPages++;
+            }
+        });
+
+        closeDocument();
+
+        if(loaded){
             
-            float successRate = (successCount * 100 / mPredictionData.size());
-            Log(log_Debug, "model.cpp", "test", "      Done. All %i samples were classified in %s seconds. Success rate is %1.2f%!", mPredictionData.size(), getDiffString(startTask).c_str(), successRate);
+            float successRate = (sampleCount > 0 ? successCount * 100.0f / sampleCount : 0);
+            Log(log_Debug, "model.cpp", "test", "      Done. All %li samples were classified in %s seconds. Success rate is %1.2f%!", sampleCount, getDiffString(startTask).c_str(), successRate);
+            if (sampleCount > 0)
+                Log(log_Debug, "model.cpp", "test", "      Classifying took %.2f ms per sample (decoding the files not included).", classifySeconds * 1000 / sampleCount);
+
+            if (summary != NULL) {
+                summary->classifier = getClassifierName();
+                summary->samples = sampleCount;
+                summary->successes = successCount;
+                summary->seconds = classifySeconds;
+            }
+
+            if (documentCount > 0) {
+                float documentSuccessRate = documentSuccessCount * 100.0f / documentCount;
+                Log(log_Debug, "model.cpp", "test", "      %li multi-page documents were classified. Document success rate is %1.2f%!", documentCount, documentSuccessRate);
+            }
             return true;
         }
         
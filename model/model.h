@@ -10,8 +10,14 @@
 #include <opencv2/ml.hpp> //SVM
 
 #include "../tools/helper.h"
+#include "../tools/metrics.h"
+#include "../tools/trace.h"
+#include "../tools/framegate.h"
 #include "sample.h"
 #include "class.h"
+#include "loader.h"
+#include "modelfile.h"
+#include "mappedsvm.h"
 
 using namespace std;
 using namespace cv;
@@ -47,14 +53,37 @@ enum enumMatcher
 	matcher_K_MEANS_CLUSTERING = 2,
 };
 
+//What a test run measured, so runs of different models over the same documents can be compared
+struct TestSummary {
+    string      classifier;
+    long        samples = 0;
+    long        successes = 0;
+    double      seconds = 0;        //classifying only, decoding the files is not counted
+};
+
 class Model {
 
     //methods
     bool                        loadTrainingSamples(string sampleFolder);
-	bool 						loadPredictionSamples(string path);
+	bool 						loadPredictionSamples(string path, function<void(Sample &)> consumer);
     bool 						preProcessSamples();
 	bool             			createDictionary();
+	bool                        extractSamples();
+	bool                        extractDescriptors(Sample &s);
+	bool                        extractProjection(Sample &s);
+	bool                        encodeDescriptors(Sample &s, vector<vector<int> > *pointIdxsOfClusters = NULL);
+	bool                        refineDictionary();
+	float                       predict(Sample &s);
 	bool 						prepareTrainingSet();
+	bool                        trainSVM();
+	float                       classifyFrame(Mat frame);
+	int                         classifyStreamFrame(Mat frame, FrameGate &gate, LabelSmoother &smoother, bool &reused);
+	bool                        loadBinary();
+	bool                        loadTrainingSet();
+	bool                        writeBundle(string filename, const Mat &dictionary, const vector<string> &labels, const FileNode &svm);
+	bool                        writeTrainingSet(string filename);
+	Mat                         getConfig();
+	bool                        setConfig(const Mat &config);
 
     Ptr<FeatureDetector>            mFeatureDetector;
     Ptr<DescriptorExtractor>        mDescriptorExtractor;
@@ -62,11 +91,11 @@ class Model {
     Ptr<DescriptorMatcher>          mDescriptorMatcher;
     Ptr<SVM>                        mSupportVectorMachine;
     Mat							    mDictionary;
+    Mat                             mWordCounts;        //training descriptors assigned to each word
     Mat							    mTrainingData;
     Mat							    mTrainingLabel;
     Ptr<BOWImgDescriptorExtractor>  mBOWDescriptorExtractor;
     vector<Class>               	mClasses;
-	vector<Sample> 					mPredictionData;
     string                      	mFilename;
     string                          mTempFolder;
     enumFeature                 	mFeatureType = feature_SIFT;
@@ -76,6 +105,19 @@ class Model {
     enumRescale                     mRescaleType = rescale_FIT;
     int					        	mDictionarySize = 1500;
     int 							mSampleDimension = 100;
+    int                             mProjectionBins = 64;   //values of every resampled profile
+    int                             mProjectionBands = 4;   //stripes with their own profiles, 0 turns them off
+    int                             mLoaderThreads = 0;
+    int                             mReadDepth = 32;
+    int                             mFrameStride = 1;
+    double                          mGateThreshold = 3.0;   //mean gray level change that triggers a new prediction
+    int                             mSmoothingWindow = 5;   //predictions in the label vote
+    bool                            mStreaming = false;
+    bool                            mReducedDecode = true;
+    bool                            mRefineDictionary = false;
+    SampleCache                     mCache;
+    ModelFileReader                 mModelFile;         //mapped binary model, see loadBinary
+    MappedSVM                       mMappedSVM;
 
 	//logging helper routines
 	string                      getClassifierName();
@@ -89,11 +131,15 @@ public:
     //methods
     bool             initialize();
     bool             create(string sampleFolder);
+    bool             update(string sampleFolder);
     bool             load();
     bool             save();
+    bool             convert(string binaryFilename);
     bool             classify(Sample s, string expectedLabel);
-    bool             test(string path);
+    bool             classify(Sample s, string expectedLabel, string &predictedLabel);
+    bool             test(string path, TestSummary *summary = NULL);
     bool             classifyCamera();
+    bool             classifyVideo(string videoFilename, string csvFilename);
 
     //setters
     void             setClassifierType(enumClassifier type);
@@ -103,6 +149,16 @@ public:
     void             setRescaleType(enumRescale type);
     void             setFilename(string filename);
     void             setTempFolder(string folder);
+    void             setLoaderThreads(int threads);
+    void             setFrameStride(int stride);
+    void             setGateThreshold(double threshold);
+    void             setSmoothingWindow(int window);
+    void             setReadDepth(int depth);
+    void             setStreaming(bool streaming);
+    void             setReducedDecode(bool reducedDecode);
+    void             setCacheFolder(string folder);
+    void             setRefineDictionary(bool refine);
+    void             setProjectionBands(int bands);
 
     //getters
     string           getFilename();
@@ -0,0 +1,262 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <fstream>
+#include "modelfile.h"
+
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + MODELFILE_ALIGNMENT - 1) / MODELFILE_ALIGNMENT * MODELFILE_ALIGNMENT;
+}
+
+static ModelFileBlock newBlock(string name, int type, int rows, int cols) {
+    ModelFileBlock block;
+    memset(&block, 0, sizeof(block));
+    strncpy(block.name, name.c_str(), sizeof(block.name) - 1);
+    block.type = type;
+    block.rows = rows;
+    block.cols = cols;
+    return block;
+}
+
+bool isModelFile(string filename) {
+
+    char magic[8] = {0};
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+    size_t length = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    return (length == sizeof(magic) && memcmp(magic, MODELFILE_MAGIC, sizeof(MODELFILE_MAGIC)) == 0);
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+void ModelFileWriter::addMat(string name, const Mat &m) {
+
+    mBlocks.push_back(newBlock(name, m.type(), m.rows, m.cols));
+    mData.push_back(vector<uchar>());
+
+    size_t rowSize = m.cols * m.elemSize();
+    vector<uchar> &data = mData.back();
+    data.resize(rowSize * m.rows);
+    for (int r = 0; r < m.rows; r++)
+        memcpy(data.data() + r * rowSize, m.ptr(r), rowSize);
+}
+
+void ModelFileWriter::addStrings(string name, const vector<string> &strings) {
+
+    mBlocks.push_back(newBlock(name, MODELFILE_STRINGS, (int) strings.size(), 1));
+    mData.push_back(vector<uchar>());
+
+    vector<uchar> &data = mData.back();
+    for (size_t i = 0; i < strings.size(); i++)
+        data.insert(data.end(), strings[i].c_str(), strings[i].c_str() + strings[i].size() + 1);
+}
+
+//Lays the blocks out (aligned) and writes the whole file with one sequential write. The file is
+//written aside and renamed over the old one, so a process that has the old file mapped keeps working.
+bool ModelFileWriter::write(string filename, uint32_t version) {
+
+    try {
+        ModelFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MODELFILE_MAGIC, sizeof(MODELFILE_MAGIC));
+        header.version = version;
+        header.blockCount = (uint32_t) mBlocks.size();
+
+        uint64_t offset = alignOffset(sizeof(ModelFileHeader) + mBlocks.size() * sizeof(ModelFileBlock));
+        for (size_t i = 0; i < mBlocks.size(); i++) {
+            mBlocks[i].offset = offset;
+            mBlocks[i].size = mData[i].size();
+            offset = alignOffset(offset + mData[i].size());
+        }
+        header.fileSize = offset;
+
+        vector<uchar> file((size_t) header.fileSize, 0);
+        memcpy(file.data(), &header, sizeof(header));
+        if (!mBlocks.empty())
+            memcpy(file.data() + sizeof(header), mBlocks.data(), mBlocks.size() * sizeof(ModelFileBlock));
+        for (size_t i = 0; i < mBlocks.size(); i++)
+            if (!mData[i].empty())
+                memcpy(file.data() + mBlocks[i].offset, mData[i].data(), mData[i].size());
+
+        header.checksum = getHash(file.data() + sizeof(header), file.size() - sizeof(header));
+        memcpy(file.data(), &header, sizeof(header));
+
+        string temporaryFilename = filename + ".tmp";
+        ofstream f(temporaryFilename.c_str(), ios::binary | ios::trunc);
+        f.write((const char *) file.data(), file.size());
+        f.close();
+
+        if (f.good() && rename(temporaryFilename.c_str(), filename.c_str()) == 0)
+            return true;
+
+        remove(temporaryFilename.c_str());
+        Log(log_Error, "modelfile.cpp", "write", "      Failed to write model file '%s'.", filename.c_str());
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "modelfile.cpp", "write", "      Error writing model file: %s", e.what());
+    }
+
+    return false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+ModelFileReader::ModelFileReader() {
+
+    //Initialize the internal variables
+    mFile = -1;
+    mData = NULL;
+    mSize = 0;
+    mHeader = NULL;
+    mBlocks = NULL;
+
+}
+
+ModelFileReader::~ModelFileReader() {
+    close();
+}
+
+void ModelFileReader::close() {
+
+    if (mData != NULL)
+        munmap((void *) mData, mSize);
+    if (mFile >= 0)
+        ::close(mFile);
+
+    mFile = -1;
+    mData = NULL;
+    mSize = 0;
+    mHeader = NULL;
+    mBlocks = NULL;
+}
+
+//Maps the file and checks that the header, the table and every block lie inside it. The checksum
+//is verified with a single sequential pass over the mapping, which also leaves the file in memory.
+bool ModelFileReader::open(string filename) {
+
+    close();
+
+    try {
+        mFile = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (mFile < 0) {
+            Log(log_Error, "modelfile.cpp", "open", "      Failed to open model file '%s'.", filename.c_str());
+            return false;
+        }
+
+        struct stat s;
+        if (fstat(mFile, &s) != 0 || s.st_size < (off_t) sizeof(ModelFileHeader)) {
+            Log(log_Error, "modelfile.cpp", "open", "      Model file '%s' is too small.", filename.c_str());
+            close();
+            return false;
+        }
+
+        mSize = (size_t) s.st_size;
+        void *data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+        if (data == MAP_FAILED) {
+            Log(log_Error, "modelfile.cpp", "open", "      Failed to map model file '%s'.", filename.c_str());
+            mData = NULL;
+            close();
+            return false;
+        }
+        mData = (const uchar *) data;
+        madvise(data, mSize, MADV_SEQUENTIAL);
+
+        mHeader = (const ModelFileHeader *) mData;
+        mBlocks = (const ModelFileBlock *) (mData + sizeof(ModelFileHeader));
+
+        bool valid = (memcmp(mHeader->magic, MODELFILE_MAGIC, sizeof(MODELFILE_MAGIC)) == 0 &&
+                      mHeader->fileSize == mSize &&
+                      sizeof(ModelFileHeader) + (uint64_t) mHeader->blockCount * sizeof(ModelFileBlock) <= mSize);
+
+        for (uint32_t i = 0; valid && i < mHeader->blockCount; i++)
+            valid = (mBlocks[i].offset % MODELFILE_ALIGNMENT == 0 && mBlocks[i].offset + mBlocks[i].size <= mSize);
+
+        if (!valid) {
+            Log(log_Error, "modelfile.cpp", "open", "      '%s' is not a valid model file.", filename.c_str());
+            close();
+            return false;
+        }
+
+        if (mHeader->version >= 2 && getHash(mData + sizeof(ModelFileHeader), mSize - sizeof(ModelFileHeader)) != mHeader->checksum) {
+            Log(log_Error, "modelfile.cpp", "open", "      Model file '%s' is corrupted (checksum mismatch).", filename.c_str());
+            close();
+            return false;
+        }
+
+        madvise(data, mSize, MADV_NORMAL);
+        return true;
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "modelfile.cpp", "open", "      Error opening model file: %s", e.what());
+    }
+
+    close();
+    return false;
+}
+
+const ModelFileBlock *ModelFileReader::findBlock(string name) {
+
+    for (uint32_t i = 0; mHeader != NULL && i < mHeader->blockCount; i++)
+        if (strncmp(mBlocks[i].name, name.c_str(), sizeof(mBlocks[i].name)) == 0)
+            return &mBlocks[i];
+
+    return NULL;
+}
+
+bool ModelFileReader::hasBlock(string name) {
+    return (findBlock(name) != NULL);
+}
+
+//A Mat over the mapped block, nothing is copied. Empty if the block is missing or does not hold a mat.
+Mat ModelFileReader::getMat(string name) {
+
+    const ModelFileBlock *block = findBlock(name);
+
+    if (block == NULL || block->type == MODELFILE_STRINGS || block->rows <= 0 || block->cols <= 0)
+        return Mat();
+
+    Mat header(block->rows, block->cols, block->type, (void *) (mData + block->offset));
+    if (header.total() * header.elemSize() != block->size)
+        return Mat();
+
+    return header;
+}
+
+vector<string> ModelFileReader::getStrings(string name) {
+
+    vector<string> res;
+    const ModelFileBlock *block = findBlock(name);
+
+    if (block == NULL || block->type != MODELFILE_STRINGS)
+        return res;
+
+    const char *p = (const char *) (mData + block->offset);
+    const char *end = p + block->size;
+
+    for (int i = 0; i < block->rows && p < end; i++) {
+        size_t length = strnlen(p, end - p);
+        res.push_back(string(p, length));
+        p += length + 1;
+    }
+
+    return res;
+}
+
+bool ModelFileReader::isOpen() {
+    return (mData != NULL);
+}
+
+uint32_t ModelFileReader::getVersion() {
+    return (mHeader != NULL ? mHeader->version : 0);
+}
+
+const uchar *ModelFileReader::getData() {
+    return mData;
+}
+
+size_t ModelFileReader::getSize() {
+    return mSize;
+}
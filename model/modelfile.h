@@ -0,0 +1,94 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Binary model container. The file is a fixed header, a block table and the
+// blocks themselves, every one of them starting on a 64 byte boundary so the
+// float blocks (vocabulary, support vectors) can be mmapped and used in place:
+//
+//   header   "DORAMDL\0" | version | block count | file size | checksum   (64 bytes)
+//   table    name | mat type | rows | cols | offset | size                   (64 bytes each)
+//   blocks   raw mat rows, or '\0' terminated strings
+//
+// All values are little endian. The checksum (version 2 and up) is the hash of
+// everything after the header. ModelFileWriter builds a file in memory and
+// writes it at once, ModelFileReader maps it and hands out Mat headers over the
+// mapped memory (read only, valid while the reader is open).
+//
+
+#ifndef DORA_MODELFILE_H
+#define DORA_MODELFILE_H
+
+#include <stdint.h>
+#include "../tools/helper.h"
+
+using namespace std;
+
+#define MODELFILE_MAGIC         "DORAMDL"
+#define MODELFILE_VERSION       2
+#define MODELFILE_ALIGNMENT     64
+#define MODELFILE_STRINGS       -1      //block type of a string list
+
+struct ModelFileHeader {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    blockCount;
+    uint64_t    fileSize;
+    uint64_t    checksum;
+    uint8_t     reserved[32];
+};
+
+struct ModelFileBlock {
+    char        name[24];
+    int32_t     type;
+    int32_t     rows;
+    int32_t     cols;
+    int32_t     reserved;
+    uint64_t    offset;
+    uint64_t    size;
+    uint64_t    reserved2;
+};
+
+class ModelFileWriter {
+    vector<ModelFileBlock>  mBlocks;
+    vector<vector<uchar> >  mData;
+
+public:
+    //Methods
+    void        addMat(string name, const Mat &m);
+    void        addStrings(string name, const vector<string> &strings);
+    bool        write(string filename, uint32_t version = MODELFILE_VERSION);
+};
+
+class ModelFileReader {
+    int                     mFile;
+    const uchar            *mData;
+    size_t                  mSize;
+    const ModelFileHeader  *mHeader;
+    const ModelFileBlock   *mBlocks;
+
+    const ModelFileBlock   *findBlock(string name);
+
+public:
+    //Constructors
+    ModelFileReader();
+    ~ModelFileReader();
+    ModelFileReader(const ModelFileReader &) = delete;
+    ModelFileReader &operator=(const ModelFileReader &) = delete;
+
+    //Methods
+    bool            open(string filename);
+    void            close();
+    bool            hasBlock(string name);
+    Mat             getMat(string name);
+    vector<string>  getStrings(string name);
+
+    //Getters
+    bool            isOpen();
+    uint32_t        getVersion();
+    const uchar    *getData();
+    size_t          getSize();
+};
+
+bool isModelFile(string filename);
+
+#endif
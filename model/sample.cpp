@@ -9,10 +9,55 @@ Sample::Sample() {
     mLabel = "";
     mFilename = "";
     mTemporaryFolder = "";
+    mPage = -1;
+    mCacheKey = "";
+    mCached = false;
 
 };
 
+//Picks the largest JPEG scale factor (1/2, 1/4 or 1/8) that still leaves the side the rescale method maps
+//onto the sample dimension at least as large as the sample dimension
+static int getReducedFactor(Size imageSize, int desiredDimension, enumRescale rescaleMethod) {
+
+    int side;
+
+    switch (rescaleMethod) {
+        case rescale_CROP:
+        case rescale_SCALE:
+            side = min(imageSize.width, imageSize.height);
+            break;
+        case rescale_FIT:
+            side = max(imageSize.width, imageSize.height);
+            break;
+        default:
+            return 1;
+    }
+
+    for (int factor = 8; factor > 1; factor /= 2)
+        if (side / factor >= desiredDimension)
+            return factor;
+
+    return 1;
+}
+
 bool Sample::load(string filename, string label, bool fixBrokenJPG) {
+    return load(filename, label, fixBrokenJPG, 0, rescale_NONE, false);
+}
+
+//Decodes the file already close to the size pre-processing is going to need. JPEG files are scaled down by
+//the decoder itself (DCT scaling) and 'grayscale' skips the colour conversion when only the gray mat is used.
+bool Sample::load(string filename, string label, bool fixBrokenJPG, int desiredDimension, enumRescale rescaleMethod, bool grayscale) {
+    return decode(filename, label, NULL, fixBrokenJPG, desiredDimension, rescaleMethod, grayscale);
+}
+
+//Same as above, from the encoded bytes of the file already in memory
+bool Sample::load(string filename, string label, const vector<uchar> &data, int desiredDimension, enumRescale rescaleMethod, bool grayscale) {
+    return decode(filename, label, &data, false, desiredDimension, rescaleMethod, grayscale);
+}
+
+bool Sample::decode(string filename, string label, const vector<uchar> *data, bool fixBrokenJPG, int desiredDimension, enumRescale rescaleMethod, bool grayscale) {
+
+    TraceSpan span("Sample::load", filename.c_str());
 
     try {
         Log(log_Detail, "sample.cpp", "load", "      Loading file '%s'...", filename.c_str());
@@ -20,12 +65,41 @@ bool Sample::load(string filename, string label, bool fixBrokenJPG) {
         mFilename = filename;
         mLabel = label;
 
-        //Loads an unchanged mat from the image file
-        originalMat = imread(mFilename, CV_LOAD_IMAGE_COLOR);
+        //Re-saving a broken JPG must keep the full image, so it is never decoded reduced
+        int readFlag = CV_LOAD_IMAGE_COLOR;
+        int factor = 1;
+        Size headerSize;
+
+        if (!fixBrokenJPG && desiredDimension > 0 && rescaleMethod != rescale_NONE) {
+            enumImageFormat format;
+            bool hasHeader = (data != NULL ? readImageHeader(data->data(), data->size(), format, headerSize) : readImageHeader(mFilename, format, headerSize));
+            if (hasHeader && format == image_JPEG)
+                factor = getReducedFactor(headerSize, desiredDimension, rescaleMethod);
+            readFlag = getReducedReadFlag(factor, grayscale);
+        }
+
+        //Loads a mat from the image file (or from its bytes)
+        {
+            MetricTimer timer(metric_IMREAD);
+            if (data != NULL)
+                originalMat = imdecode(*data, readFlag);
+            else
+                originalMat = imread(mFilename, readFlag);
+        }
 
         //Do we have a mat?
         if (isMatValid(originalMat)) {
 
+            //Keeps the full image size (the decoder may have rotated it following the EXIF orientation)
+            mOriginalSize = originalMat.size();
+            if (factor > 1) {
+                bool landscape = (originalMat.cols > originalMat.rows);
+                mOriginalSize = (landscape == (headerSize.width > headerSize.height) ? headerSize : Size(headerSize.height, headerSize.width));
+                Log(log_Detail, "sample.cpp", "load", "      File decoded at 1/%i scale (W:%i x H:%i).", factor, originalMat.cols, originalMat.rows);
+            }
+
+            incrementCounter(counter_SAMPLES_LOADED);
+
             if (fixBrokenJPG) {
                 Log(log_Detail, "sample.cpp", "load",
                     "      Saving file again to avoid the 'Premature end of JPEG file' exception...");
@@ -36,6 +110,7 @@ bool Sample::load(string filename, string label, bool fixBrokenJPG) {
             return true;
 
         } else {
+            incrementCounter(counter_LOAD_FAILURES);
             Log(log_Error, "sample.cpp", "load", "      File was loaded but image mat is invalid!");
         }
 
@@ -48,12 +123,18 @@ bool Sample::load(string filename, string label, bool fixBrokenJPG) {
 }
 
 bool Sample::set(Mat inputMat){
+    return set(inputMat, "", "", -1);
+}
+
+//Sets an already decoded mat, such as one page of a multi-page document ('page' is zero based, -1 for a whole file)
+bool Sample::set(Mat inputMat, string filename, string label, int page){
     
     try {
         Log(log_Detail, "sample.cpp", "set", "      Loading mat...");
         
-        mFilename = "";
-        mLabel = "";
+        mFilename = filename;
+        mLabel = label;
+        mPage = page;
         
         //Loads an unchanged mat from the image file
         originalMat = inputMat;
@@ -61,6 +142,7 @@ bool Sample::set(Mat inputMat){
         //Do we have a mat?
         if (isMatValid(originalMat)) {
             
+            mOriginalSize = originalMat.size();
             Log(log_Detail, "sample.cpp", "set", "      Mat was set.");
             return true;
             
@@ -76,6 +158,16 @@ bool Sample::set(Mat inputMat){
     
 }
 
+//Marks a sample whose binary mat, keypoints and descriptors were read from the cache (it has no original mat)
+void Sample::setCached(string filename, string label, Size originalSize, string cacheKey) {
+    mFilename = filename;
+    mLabel = label;
+    mOriginalSize = originalSize;
+    mCacheKey = cacheKey;
+    mPage = -1;
+    mCached = true;
+}
+
 string Sample::getLabel() {
     return mLabel;
 }
@@ -84,12 +176,43 @@ string Sample::getFilename() {
     return mFilename;
 }
 
+Size Sample::getOriginalSize() {
+    return mOriginalSize;
+}
+
+int Sample::getPage() {
+    return mPage;
+}
+
+string Sample::getCacheKey() {
+    return mCacheKey;
+}
+
+bool Sample::isCached() {
+    return mCached;
+}
+
+void Sample::setCacheKey(string key) {
+    mCacheKey = key;
+}
+
+//Drops every image mat, keeping only the label, keypoints and descriptors
+void Sample::releaseImages() {
+    originalMat.release();
+    workMat.release();
+    grayMat.release();
+    binaryMat.release();
+    XYCutMat.release();
+}
+
 void Sample::setTemporaryFolder(string folder) {
     mTemporaryFolder = folder;
 }
 
 bool Sample::preProcess(int desiredDimension, enumRescale rescaleMethod, enumBinarization binMethod) {
 
+    TraceSpan span("Sample::preProcess");
+
     try {
         //1) Is sample valid?
         if (isMatValid(originalMat)) {
@@ -103,36 +226,43 @@ bool Sample::preProcess(int desiredDimension, enumRescale rescaleMethod, enumBin
                     //4) Can we create a binary mat from the grayscale mat?
                     if (createBinaryMat(binMethod)) {
 
-                        //5) Can we create the XY Cut mats?
-                        if (createXYCutMat()) {
+                        //5) Can we create the projection profiles? (the XY Cut mat is only drawn if it is dumped)
+                        int stages = (mFilename != "" ? selectArtifactStages() : 0);
+                        if (createProjectionProfile((stages & stage_XYCUT) != 0)) {
                             
-                            if(mFilename != ""){
-                                
+                            //Should we save the intermediate files? (queued, see artifacts.h)
+                            if (stages != 0) {
+
                                 string filename = getFileName(mFilename);
                                 string extension = toLower(filename.substr(filename.find_last_of(".") + 1));
                                 filename = toLower(filename.substr(0, filename.find_last_of(".") ));
-    
-                                //Should we save the intermediate files?
-                                //saveMat(originalMat,  mTemporaryFolder + filename + "_original." + extension );
-    
-                                //if(rescaleMethod != rescale_NONE)
-                                //    saveMat(workMat,      mTemporaryFolder + filename + "_work_" + mLabel + "." + extension);
-    
-                                //saveMat(grayMat,      mTemporaryFolder + filename + "_grayscale" + mLabel + "." + extension);
-    
-                                //if(binMethod != binarization_NONE)
-                                //    saveMat(binaryMat,    mTemporaryFolder + filename + "_" +  mLabel + "." + extension);
-                                saveMat(binaryMat,    mTemporaryFolder + mLabel + "_" + filename + "." + extension);
-    
-                                //saveMat(XYCutMat,     mTemporaryFolder + filename + "_xycut"     + mLabel + "." + extension);
+                                if (mPage >= 0)
+                                    filename += "_p" + to_string(mPage + 1);
+                                if (extension == "pdf" || extension == "tif" || extension == "tiff")
+                                    extension = "png";
+
+                                if (stages & stage_ORIGINAL)
+                                    writeArtifact(originalMat, mTemporaryFolder + filename + "_original." + extension);
 
+                                if ((stages & stage_WORK) && rescaleMethod != rescale_NONE)
+                                    writeArtifact(workMat, mTemporaryFolder + filename + "_work_" + mLabel + "." + extension);
+
+                                if (stages & stage_GRAYSCALE)
+                                    writeArtifact(grayMat, mTemporaryFolder + filename + "_grayscale" + mLabel + "." + extension);
+
+                                if (stages & stage_BINARY)
+                                    writeArtifact(binaryMat, mTemporaryFolder + mLabel + "_" + filename + "." + extension);
+
+                                if (stages & stage_XYCUT)
+                                    writeArtifact(XYCutMat, mTemporaryFolder + filename + "_xycut" + mLabel + "." + extension);
                             }
     
+                            incrementCounter(counter_SAMPLES_PREPROCESSED);
                             Log(log_Detail, "sample.cpp", "preProcess","            Done. Sample was pre-processed successfully.");
                             return true;
                             
                         }else
-                            Log(log_Error, "sample.cpp", "preProcess", "            Ignoring sample because xyCut mat is invalid ('%s').", mFilename.c_str());
+                            Log(log_Error, "sample.cpp", "preProcess", "            Ignoring sample because projection profiles are invalid ('%s').", mFilename.c_str());
                     }else
                         Log(log_Error, "sample.cpp", "preProcess","            Ignoring sample because binary mat is invalid ('%s').", mFilename.c_str());
                 }else
@@ -146,6 +276,7 @@ bool Sample::preProcess(int desiredDimension, enumRescale rescaleMethod, enumBin
         Log(log_Error, "sample.cpp", "createWorkMat", "         Failed to create mat: %s", e.what());
     }
     
+    incrementCounter(counter_PREPROCESS_FAILURES);
     return false;
 }
 
@@ -171,67 +302,69 @@ bool Sample::createWorkMat(int desiredDimension, enumRescale rescaleMethod) {
     
     //To shrink an image, it will generally look best with CV_INTER_AREA interpolation,
     //To enlarge an image, it will generally look best with CV_INTER_CUBIC (slow) or CV_INTER_LINEAR (faster but still looks OK).
+    //
+    //Gray first: nothing after this step uses colour, so the geometric work runs on a single channel
+    //(a third of the bytes), and every rescale method reaches the final square in one resampling.
+
+    TraceSpan span("createWorkMat");
+    MetricTimer timer(metric_WORK_MAT);
 
     try {
         Log(log_Detail, "sample.cpp", "createWorkMat", "      Creating work mat...");
 
         if (isMatValid(originalMat)) {
-            
+
+            int newSize = (originalMat.cols > originalMat.rows ? originalMat.rows : originalMat.cols);
+            Mat sourceMat = originalMat;
+
+            //CROP only converts the square it keeps
+            if (rescaleMethod == rescale_CROP) {
+                Rect roi;
+                roi.x = (originalMat.cols > originalMat.rows ? (originalMat.cols / 2) - (newSize / 2) : 0);
+                roi.y = (originalMat.cols > originalMat.rows ? 0 : (originalMat.rows / 2) - (newSize / 2));
+                roi.width = newSize;
+                roi.height = newSize;
+                sourceMat = originalMat(roi);
+            }
+
+            //the intermediate and the work mat take their buffers from the pool (the previous sample's, usually)
+            Mat singleChannelMat;
+            preparePooledMat(workMat);
+            if (sourceMat.channels() == 1)
+                singleChannelMat = sourceMat;
+            else {
+                preparePooledMat(singleChannelMat);
+                cvtColor(sourceMat, singleChannelMat, (sourceMat.channels() == 4 ? CV_BGRA2GRAY : CV_BGR2GRAY));
+            }
+
             if(rescaleMethod != rescale_NONE) {
-                
-                int resizeMethod = 0;
-                Mat tempMat;
-                int newSize = (originalMat.cols > originalMat.rows ? originalMat.rows : originalMat.cols);
-    
-                //Log(log_Detail, "sample.cpp", "createWorkMat", "            Original size is W:%i x H:%i", originalMat.cols, originalMat.rows);
-                //Log(log_Detail, "sample.cpp", "createWorkMat", "            Rescaled size is W:%i x H:%i", newSize, newSize);
-                //Log(log_Detail, "sample.cpp", "createWorkMat", "            Desired size is W:%i x H:%i", desiredDimension, desiredDimension);
-    
-                switch (rescaleMethod) {
-                    case rescale_CROP: {
-                        Rect roi;
-                        roi.x = (originalMat.cols > originalMat.rows ? (originalMat.cols / 2) - (newSize / 2) : 0);
-                        roi.y = (originalMat.cols > originalMat.rows ? 0 : (originalMat.rows / 2) - (newSize / 2));
-                        roi.width = newSize;
-                        roi.height = newSize;
-                        tempMat = originalMat(roi);
-                        break;
-                    }
-                    case rescale_SCALE: {
-                        tempMat = originalMat;
-                        break;
-                    }
-                    case rescale_FIT: {
-                        Rect roi;
-                        tempMat = Mat(newSize, newSize, originalMat.type(), Scalar(255, 255, 255));
-            
-                        if (originalMat.cols > originalMat.rows) {
-                            roi.width = newSize;
-                            roi.x = 0;
-                            roi.height = (originalMat.rows * newSize) / originalMat.cols;
-                            roi.y = (newSize / 2) - (roi.height / 2);
-                        } else {
-                            roi.height = newSize;
-                            roi.y = 0;
-                            roi.width = (originalMat.cols * newSize) / originalMat.rows;
-                            roi.x = (newSize / 2) - (roi.width / 2);
-                        }
-                        resize(originalMat, tempMat(roi), roi.size());
-                        break;
+
+                //FIT draws the page straight into the final square, white around it
+                Rect roi(0, 0, desiredDimension, desiredDimension);
+                if (rescaleMethod == rescale_FIT) {
+                    workMat.create(desiredDimension, desiredDimension, CV_8UC1);
+                    workMat.setTo(Scalar(255));
+
+                    if (singleChannelMat.cols > singleChannelMat.rows) {
+                        roi.height = max((singleChannelMat.rows * desiredDimension) / singleChannelMat.cols, 1);
+                        roi.y = (desiredDimension / 2) - (roi.height / 2);
+                    } else {
+                        roi.width = max((singleChannelMat.cols * desiredDimension) / singleChannelMat.rows, 1);
+                        roi.x = (desiredDimension / 2) - (roi.width / 2);
                     }
                 }
-    
+
                 //Are we shrinking
-                if (desiredDimension > tempMat.cols)
-                    resizeMethod = CV_INTER_CUBIC;
-                else
-                    resizeMethod = CV_INTER_AREA;
-    
-                Size s = Size(desiredDimension, desiredDimension);
-                resize(tempMat, workMat, s, 0, 0, resizeMethod);
-                
+                int resizeMethod = (roi.width > singleChannelMat.cols || roi.height > singleChannelMat.rows ? CV_INTER_CUBIC : CV_INTER_AREA);
+
+                if (rescaleMethod == rescale_FIT) {
+                    Mat target = workMat(roi);
+                    resize(singleChannelMat, target, roi.size(), 0, 0, resizeMethod);
+                } else
+                    resize(singleChannelMat, workMat, roi.size(), 0, 0, resizeMethod);
+
             }else{
-                workMat = originalMat;
+                workMat = singleChannelMat;
             }
             
             Log(log_Detail, "sample.cpp", "createWorkMat","            Done. Work mat created (original size was W:%i x H:%i, new size is W:%i, H:%i).", originalMat.cols, originalMat.rows, workMat.cols, workMat.rows);
@@ -251,13 +384,21 @@ bool Sample::createWorkMat(int desiredDimension, enumRescale rescaleMethod) {
 
 bool Sample::createGrayscaleMat() {
     
+    TraceSpan span("createGrayscaleMat");
+    MetricTimer timer(metric_GRAYSCALE_MAT);
+
     try {
         Log(log_Detail, "sample.cpp", "createGrayscaleMat", "         Creating grayscale mat...");
     
         if (isMatValid(workMat)) {
     
             //convert the originalMat to grayscale (ignores it if is already grayscale). This functions combines RGB values with weights R=, G= and B=)
-            cvtColor(workMat, grayMat, CV_BGR2GRAY);
+            if (workMat.channels() == 1)
+                grayMat = workMat;
+            else {
+                preparePooledMat(grayMat);
+                cvtColor(workMat, grayMat, CV_BGR2GRAY);
+            }
             
             if (isMatValid(grayMat)) {
                 Log(log_Detail, "sample.cpp", "createGrayscaleMat", "            Done. Grayscale mat was created.");
@@ -281,7 +422,11 @@ bool Sample::createBinaryMat(enumBinarization binMethod) {
         if (isMatValid(grayMat)) {
     
             //converts the gray mat to a black and white one
-            binarize(grayMat, binaryMat, binMethod);
+            {
+                TraceSpan span("binarize");
+                MetricTimer timer(metric_BINARIZE);
+                binarize(grayMat, binaryMat, binMethod);
+            }
     
             if (isMatValid(binaryMat)) {
                 Log(log_Detail, "sample.cpp", "createBinaryMat", "            Done. Binary mat created.");
@@ -297,25 +442,38 @@ bool Sample::createBinaryMat(enumBinarization binMethod) {
     return false;
 }
 
-bool Sample::createXYCutMat() {
+bool Sample::createProjectionProfile(bool renderXYCut) {
     
     try {
-        Log(log_Detail, "sample.cpp", "createXYCutMat", "         Creating XYCut mats from binary mat...");
+        Log(log_Detail, "sample.cpp", "createProjectionProfile", "         Creating projection profiles from binary mat...");
     
         if (isMatValid(binaryMat)) {
     
-            getXYCut(binaryMat, XYCutMat);
+            bool created;
+            {
+                TraceSpan span("getProjectionProfile");
+                MetricTimer timer(metric_XYCUT);
+                created = getProjectionProfile(binaryMat, profile);
+            }
+
+            //The XY Cut mat only pictures the profiles, nothing else reads it
+            XYCutMat.release();
+            if (created && renderXYCut) {
+                TraceSpan span("drawXYCut");
+                preparePooledMat(XYCutMat);
+                created = drawXYCut(binaryMat, profile, XYCutMat);
+            }
     
-            if (isMatValid(XYCutMat)) {
-                Log(log_Detail, "sample.cpp", "createXYCutMat", "            Done. XYCut mat created.");
+            if (created) {
+                Log(log_Detail, "sample.cpp", "createProjectionProfile", "            Done. Projection profiles created.");
                 return true;
             }
         }
         
     } catch (const std::exception &e) {
-        Log(log_Error, "sample.cpp", "createXYCutMat", "         Failed to create XYCut mat: %s", e.what());
+        Log(log_Error, "sample.cpp", "createProjectionProfile", "         Failed to create projection profiles: %s", e.what());
     }
     
-    Log(log_Warning, "sample.cpp", "createXYCutMat", "            Creating XYCut mats failed.");
+    Log(log_Warning, "sample.cpp", "createProjectionProfile", "            Creating projection profiles failed.");
     return false;
 }
@@ -8,6 +8,11 @@
 #include "../tools/helper.h"
 #include "../tools/binarization.h"
 #include "../tools/xycut.h"
+#include "../tools/metrics.h"
+#include "../tools/trace.h"
+#include "../tools/imageio.h"
+#include "../tools/artifacts.h"
+#include "../tools/matpool.h"
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -27,12 +32,17 @@ class Sample{
     string mLabel;
     string mFilename;
     string mTemporaryFolder;
+    Size   mOriginalSize;
+    int    mPage;
+    string mCacheKey;
+    bool   mCached;
 
     bool createWorkMat(int desiredDimension, enumRescale rescaleMethod);
     bool createGrayscaleMat();
     bool createBinaryMat(enumBinarization binMethod);
-    bool createXYCutMat();
+    bool createProjectionProfile(bool renderXYCut);
     bool saveMat(Mat input, string filename);
+    bool decode(string filename, string label, const vector<uchar> *data, bool fixBrokenJPG, int desiredDimension, enumRescale rescaleMethod, bool grayscale);
 
 public:
     //Constructors
@@ -40,22 +50,34 @@ public:
 
     //Method
     bool load(string filename, string label, bool fixBrokenJPG);
+    bool load(string filename, string label, bool fixBrokenJPG, int desiredDimension, enumRescale rescaleMethod, bool grayscale);
+    bool load(string filename, string label, const vector<uchar> &data, int desiredDimension, enumRescale rescaleMethod, bool grayscale);
     bool set(Mat inputMat);
+    bool set(Mat inputMat, string filename, string label, int page);
+    void setCached(string filename, string label, Size originalSize, string cacheKey);
     bool preProcess(int desiredDimension, enumRescale rescaleMethod, enumBinarization binMethod);
+    void releaseImages();
 
     //Getters
     string      getFilename();
     string      getLabel();
+    Size        getOriginalSize();
+    int         getPage();
+    string      getCacheKey();
+    bool        isCached();
 
     //Setter
     void setTemporaryFolder(string folder);
+    void setCacheKey(string key);
 
     //Public properties
     Mat     originalMat;
     Mat     workMat;
     Mat     grayMat;
     Mat     binaryMat;
-    Mat     XYCutMat;
+    Mat     XYCutMat;           //only drawn when the XY Cut artifact is dumped
+
+    ProjectionProfile profile;
 
     vector<KeyPoint> features;
     Mat              dic_descriptors;
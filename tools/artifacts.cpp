@@ -0,0 +1,144 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <opencv2/imgcodecs.hpp>
+#include "artifacts.h"
+#include "metrics.h"
+#include "queue.h"
+
+#define ARTIFACT_QUEUE_SIZE   256       //mats waiting for the writer, more are dropped
+
+struct ArtifactJob {
+    string  filename;
+    Mat     mat;
+};
+
+static unique_ptr<BoundedQueue<ArtifactJob> >   artifact_queue;
+static atomic<int>                              artifact_policy(artifact_NONE);
+static atomic<int>                              artifact_sampleRate(1);
+static atomic<long>                             artifact_sampleCount(0);
+static atomic<bool>                             artifact_running(false);
+static thread                                   artifact_thread;
+static mutex                                    artifact_controlMutex;
+
+static void writerThread(){
+
+    ArtifactJob job;
+
+    while (artifact_queue->pop(job)) {
+        try {
+            if (imwrite(job.filename, job.mat))
+                incrementCounter(counter_ARTIFACTS_WRITTEN);
+            else
+                Log(log_Error, "artifacts.cpp", "writerThread", "         Failed to write artifact '%s'.", job.filename.c_str());
+        } catch (const std::exception &e) {
+            Log(log_Error, "artifacts.cpp", "writerThread", "         Failed to write artifact '%s': %s", job.filename.c_str(), e.what());
+        }
+        job.mat.release();
+    }
+}
+
+bool startArtifactWriter(enumArtifactPolicy policy, int sampleRate){
+
+    lock_guard<mutex> lock(artifact_controlMutex);
+
+    if (artifact_running.load(memory_order_acquire))
+        return true;
+
+    artifact_policy.store(policy, memory_order_release);
+    artifact_sampleRate.store(max(sampleRate, 1), memory_order_release);
+    artifact_sampleCount.store(0, memory_order_relaxed);
+
+    if (policy == artifact_NONE)
+        return true;
+
+    artifact_queue.reset(new BoundedQueue<ArtifactJob>(ARTIFACT_QUEUE_SIZE));
+    artifact_thread = thread(writerThread);
+    artifact_running.store(true, memory_order_release);
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(stopArtifactWriter);
+        registered = true;
+    }
+
+    return true;
+}
+
+//Writes whatever is still queued before returning
+void stopArtifactWriter(){
+
+    lock_guard<mutex> lock(artifact_controlMutex);
+
+    if (!artifact_running.load(memory_order_acquire))
+        return;
+
+    artifact_running.store(false, memory_order_release);
+    artifact_queue->close();
+    if (artifact_thread.joinable())
+        artifact_thread.join();
+
+    if (getCounter(counter_ARTIFACTS_DROPPED) > 0)
+        Log(log_Warning, "artifacts.cpp", "stopArtifactWriter", "   %ld artifacts were dropped because the writer queue was full.", getCounter(counter_ARTIFACTS_DROPPED));
+}
+
+//'none', 'binary', 'all' or 'sampled:N'
+bool parseArtifactPolicy(string text, enumArtifactPolicy &policy, int &sampleRate){
+
+    text = toLower(text);
+    sampleRate = 1;
+
+    if (text == "none")
+        policy = artifact_NONE;
+    else if (text == "binary")
+        policy = artifact_BINARY;
+    else if (text == "all")
+        policy = artifact_ALL;
+    else if (text.compare(0, 8, "sampled:") == 0 && atoi(text.c_str() + 8) > 0) {
+        policy = artifact_SAMPLED;
+        sampleRate = atoi(text.c_str() + 8);
+    } else
+        return false;
+
+    return true;
+}
+
+//Stages the next pre-processed sample should dump. Stages that are not dumped need not be rendered at all.
+int selectArtifactStages(){
+
+    if (!artifact_running.load(memory_order_acquire))
+        return 0;
+
+    switch (artifact_policy.load(memory_order_relaxed)) {
+        case artifact_BINARY:
+            return stage_BINARY;
+        case artifact_ALL:
+            return stage_ALL;
+        case artifact_SAMPLED:
+            return (artifact_sampleCount.fetch_add(1, memory_order_relaxed) % artifact_sampleRate.load(memory_order_relaxed) == 0 ? stage_ALL : 0);
+        default:
+            return 0;
+    }
+}
+
+//Never blocks: the mat is copied only if the queue has room for it
+bool writeArtifact(const Mat &m, string filename){
+
+    if (!artifact_running.load(memory_order_acquire) || !isMatValid(m))
+        return false;
+
+    if (artifact_queue->size() < ARTIFACT_QUEUE_SIZE) {
+        ArtifactJob job;
+        job.filename = filename;
+        job.mat = m.clone();
+        if (artifact_queue->tryPush(std::move(job)))
+            return true;
+    }
+
+    incrementCounter(counter_ARTIFACTS_DROPPED);
+    return false;
+}
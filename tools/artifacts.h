@@ -0,0 +1,45 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Intermediate images (original, working, grayscale, binary and XY cut mats)
+// dumped while samples are pre-processed. What is dumped depends on the
+// policy: nothing, the binary mats, every stage, or every stage of one sample
+// in N. The mats are handed to a background writer through a bounded queue;
+// when the queue is full the artifact is dropped (and counted), so dumping
+// never adds latency to the caller.
+//
+
+#ifndef DORA_ARTIFACTS_H
+#define DORA_ARTIFACTS_H
+
+#include <string>
+#include "helper.h"
+
+using namespace std;
+
+enum enumArtifactPolicy
+{
+    artifact_NONE = 0,
+    artifact_BINARY = 1,
+    artifact_ALL = 2,
+    artifact_SAMPLED = 3,
+};
+
+enum enumArtifactStage
+{
+    stage_ORIGINAL = 1,
+    stage_WORK = 2,
+    stage_GRAYSCALE = 4,
+    stage_BINARY = 8,
+    stage_XYCUT = 16,
+    stage_ALL = 31,
+};
+
+bool startArtifactWriter(enumArtifactPolicy policy, int sampleRate = 1);
+void stopArtifactWriter();
+
+bool parseArtifactPolicy(string text, enumArtifactPolicy &policy, int &sampleRate);
+int  selectArtifactStages();
+bool writeArtifact(const Mat &m, string filename);
+
+#endif
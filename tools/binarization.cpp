@@ -1,250 +1,589 @@
 //
 // Guttemberg Machado on 24/07/17.
 //
+#include <mutex>
 #include "binarization.h"
+#include "matpool.h"
 
-double calcLocalStats(Mat &im, Mat &map_m, Mat &map_s, int winX, int winY) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DORA_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
 
-    // *************************************************************
-    // glide a window across the image and
-    // create two maps: mean and standard deviation.
-    //
-    // Version patched by Thibault Yohan (using opencv integral images)
-    // *************************************************************
+static bool binarization_simd = true;
 
-    Mat im_sum, im_sum_sq;
-    cv::integral(im, im_sum, im_sum_sq, CV_64F);
+void setBinarizationSIMD(bool enabled) {
+    binarization_simd = enabled;
+}
+
+bool isBinarizationSIMD() {
+#ifdef DORA_AVX2_DISPATCH
+    return binarization_simd && __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
 
-    double max_s, sum, sum_sq;
-    float s;
-    float m;
-    int wxh = winX / 2;
-    int wyh = winY / 2;
-    int x_firstth = wxh;
-    int y_lastth = im.rows - wyh - 1;
-    int y_firstth = wyh;
-    double winarea = winX*winY;
+//---------------------------------------------------------------------------------------------------------------------------
+// The local methods run in horizontal strips of output rows. A strip builds the column sums of the window rows
+// around its first row (its halo) and slides them down from there, so it only holds a few cols-sized buffers
+// (24 bytes per column for Niblack/Sauvola/Wolf-Jolion, 13 for Bradley, which stays in L2 for any page) instead of
+// full-image integrals and maps. Strips are independent and run across cores. Every strip builds its own halo,
+// so strips are kept at least half a window tall.
+//---------------------------------------------------------------------------------------------------------------------------
+
+#define STRIP_PARALLEL_PIXELS   (256 * 256)     //smaller images are thresholded on the calling thread
+
+//The result goes straight into the output, unless it is the input (strips read the rows around their own)
+static Mat getStripOutput(const Mat &inputMat, Mat &outputMat) {
+
+    Mat resultMat = (outputMat.data == inputMat.data ? Mat() : outputMat);
+    resultMat.create(inputMat.size(), CV_8U);
+    return resultMat;
+}
 
-    max_s = 0;
-    for (int j = y_firstth; j <= y_lastth; j++){
-        sum = sum_sq = 0;
+static void runStrips(const Range &rows, size_t pixels, const ParallelLoopBody &body, int windowRows) {
 
-        sum = im_sum.at<double>(j - wyh + winY, winX) - im_sum.at<double>(j - wyh, winX) - im_sum.at<double>(j - wyh + winY, 0) + im_sum.at<double>(j - wyh, 0);
-        sum_sq = im_sum_sq.at<double>(j - wyh + winY, winX) - im_sum_sq.at<double>(j - wyh, winX) - im_sum_sq.at<double>(j - wyh + winY, 0) + im_sum_sq.at<double>(j - wyh, 0);
+    if (pixels < STRIP_PARALLEL_PIXELS) {
+        body(rows);
+        return;
+    }
 
-        m = (float) (sum / winarea);
-        s = (float) (sqrt((sum_sq - m * sum) / winarea));
-        if (s > max_s) max_s = s;
+    double stripes = max(1.0, min((double) getNumThreads() * 2, 2.0 * rows.size() / windowRows));
+    parallel_for_(rows, body, stripes);
+}
 
-        map_m.fset(x_firstth, j, m);
-        map_s.fset(x_firstth, j, s);
+//---------------------------------------------------------------------------------------------------------------------------
+// Niblack, Sauvola and Wolf-Jolion: the threshold of a pixel comes from the mean (m) and standard deviation (s)
+// of the winX x winY window centred on it.
+//
+// Christian Wolf, Jean-Michel Jolion and Francoise Chassaing.
+// Text Localization, Enhancement and Binarization in Multimedia Documents.
+// International Conference on Pattern Recognition (ICPR),
+// volume 4, pages 1037-1040, 2002.
+//
+// Each strip of rows keeps, for every column, the sum (and sum of squares) of the winY rows of the current window,
+// updated as the window moves down. A running prefix of them along the row gives any horizontal window with two
+// reads. The sums are integers, so they equal the values the double integral images of the original code gave,
+// and m and s are rounded the same way (m to float before s is computed from it): the output is bit-compatible.
+// The formula is a template parameter, the threshold is compared as soon as it is computed, and strips of rows run
+// in parallel. Borders behave as before: rows above (below) the first (last) full window use its thresholds, so
+// do the columns left of the first full window, and columns from cols - wxh - 1 on use the last full window.
+//---------------------------------------------------------------------------------------------------------------------------
+
+struct LocalWindow {
+    int     winX, winY;
+    int     wxh, wyh;
+    int     xLast;          //first column that takes the threshold of the last full window
+    int     cLast;          //centre column of the last full window
+    int     yFirst, yLast;  //centre rows of the first and last full windows
+    double  area;
+};
+
+struct LocalThreshold {
+    double  k;
+    double  dR;
+    double  maxS;
+    double  minI;
+};
+
+static LocalWindow getLocalWindow(int rows, int cols, int winX, int winY) {
+
+    LocalWindow w;
+    w.winX = winX;
+    w.winY = winY;
+    w.wxh = winX / 2;
+    w.wyh = winY / 2;
+    w.xLast = cols - w.wxh - 1;
+    w.cLast = cols - winX + w.wxh;
+    w.yFirst = w.wyh;
+    w.yLast = rows - w.wyh - 1;
+    w.area = winX * winY;
+    return w;
+}
 
-        // Shift the window, add and remove	new/old values to the histogram
-        for (int i = 1; i <= im.cols - winX; i++) {
+template <int METHOD> inline double localThreshold(double m, double s, const LocalThreshold &p);
 
-            // Remove the left old column and add the right new column
-            sum -= im_sum.at<double>(j - wyh + winY, i) - im_sum.at<double>(j - wyh, i) - im_sum.at<double>(j - wyh + winY, i - 1) + im_sum.at<double>(j - wyh, i - 1);
-            sum += im_sum.at<double>(j - wyh + winY, i + winX) - im_sum.at<double>(j - wyh, i + winX) - im_sum.at<double>(j - wyh + winY, i + winX - 1) + im_sum.at<double>(j - wyh, i + winX - 1);
+template <> inline double localThreshold<binarization_NIBLACK>(double m, double s, const LocalThreshold &p) {
+    return m + p.k * s;
+}
 
-            sum_sq -= im_sum_sq.at<double>(j - wyh + winY, i) - im_sum_sq.at<double>(j - wyh, i) - im_sum_sq.at<double>(j - wyh + winY, i - 1) + im_sum_sq.at<double>(j - wyh, i - 1);
-            sum_sq += im_sum_sq.at<double>(j - wyh + winY, i + winX) - im_sum_sq.at<double>(j - wyh, i + winX) - im_sum_sq.at<double>(j - wyh + winY, i + winX - 1) + im_sum_sq.at<double>(j - wyh, i + winX - 1);
+template <> inline double localThreshold<binarization_SAUVOLA>(double m, double s, const LocalThreshold &p) {
+    return m * (1 + p.k * (s / p.dR - 1));
+}
 
-            m = (float) (sum / winarea);
-            s = (float) sqrt((sum_sq - m*sum) / winarea);
-            if (s > max_s) max_s = s;
+template <> inline double localThreshold<binarization_WOLFJOLION>(double m, double s, const LocalThreshold &p) {
+    return m + p.k * (s / p.maxS - 1) * (m - p.minI);
+}
 
-            map_m.fset(i + wxh, j, m);
-            map_s.fset(i + wxh, j, s);
+//Mean and deviation of the window that starts at column 'first' (centre first + wxh)
+static inline void localStats(const double *sums, const double *squares, int first, const LocalWindow &w, float &m, float &s) {
+
+    double sum = sums[first + w.winX] - sums[first];
+    double sumSq = squares[first + w.winX] - squares[first];
+    m = (float) (sum / w.area);
+    s = (float) sqrt((sumSq - m * sum) / w.area);
+}
+
+//Column sums of the winY rows starting at 'top'
+static void localColumnsInit(const Mat &input, int top, const LocalWindow &w, int32_t *colSum, int32_t *colSq) {
+
+    memset(colSum, 0, input.cols * sizeof(int32_t));
+    memset(colSq, 0, input.cols * sizeof(int32_t));
+
+    for (int r = top; r < top + w.winY; r++) {
+        const uchar *in = input.ptr<uchar>(r);
+        for (int c = 0; c < input.cols; c++) {
+            colSum[c] += in[c];
+            colSq[c] += in[c] * in[c];
         }
     }
+}
 
-    return max_s;
+static void localColumnsSlideScalar(const uchar *added, const uchar *removed, int first, int cols, int32_t *colSum, int32_t *colSq) {
+
+    for (int c = first; c < cols; c++) {
+        colSum[c] += added[c] - removed[c];
+        colSq[c] += added[c] * added[c] - removed[c] * removed[c];
+    }
 }
 
-void NiblackSauvolaWolfJolion(Mat inputMat, Mat &outputMat, enumBinarization method, int winX, int winY, double k, double dR) {
+static void localPrefix(const int32_t *colSum, const int32_t *colSq, int cols, double *sums, double *squares) {
 
-    // Christian Wolf, Jean-Michel Jolion and Francoise Chassaing.
-    // Text Localization, Enhancement and Binarization in Multimedia Documents.
-    // International Conference on Pattern Recognition (ICPR),
-    // volume 4, pages 1037-1040, 2002.
-
-    double m, s, max_s;
-    float th = 0;
-    double min_I, max_I;
-    int wxh = winX / 2;
-    int wyh = winY / 2;
-    int x_firstth = wxh;
-    int x_lastth = inputMat.cols - wxh - 1;
-    int y_lastth = inputMat.rows - wyh - 1;
-    int y_firstth = wyh;
-
-    // Create local statistics and store them in a double matrices
-    Mat map_m = Mat::zeros(inputMat.rows, inputMat.cols, CV_32F);
-    Mat map_s = Mat::zeros(inputMat.rows, inputMat.cols, CV_32F);
-    max_s = calcLocalStats(inputMat, map_m, map_s, winX, winY);
-
-    minMaxLoc(inputMat, &min_I, &max_I);
-
-    Mat thsurf(inputMat.rows, inputMat.cols, CV_32F);
-
-    // Create the threshold surface, including border processing
-    for (int j = y_firstth; j <= y_lastth; j++) {
-
-        // NORMAL, NON-BORDER AREA IN THE MIDDLE OF THE WINDOW:
-        for (int i = 0; i <= inputMat.cols - winX; i++) {
-
-            m = map_m.fget(i + wxh, j);
-            s = map_s.fget(i + wxh, j);
-
-            // Calculate the threshold
-            switch (method) {
-
-                case binarization_NIBLACK:
-                    th = (float) (m + k*s);
-                    break;
-
-                case binarization_SAUVOLA:
-                    th = (float) (m * (1 + k*(s / dR - 1)));
-                    break;
-
-                case binarization_WOLFJOLION:
-                    th = (float) (m + k * (s / max_s - 1) * (m - min_I));
-                    break;
-            }
-
-            thsurf.fset(i + wxh, j, th);
-
-            if (i == 0) {
-                // LEFT BORDER
-                for (int i = 0; i <= x_firstth; ++i)
-                    thsurf.fset(i, j, th);
-
-                // LEFT-UPPER CORNER
-                if (j == y_firstth)
-                    for (int u = 0; u<y_firstth; ++u)
-                        for (int i = 0; i <= x_firstth; ++i)
-                            thsurf.fset(i, u, th);
-
-                // LEFT-LOWER CORNER
-                if (j == y_lastth)
-                    for (int u = y_lastth + 1; u<inputMat.rows; ++u)
-                        for (int i = 0; i <= x_firstth; ++i)
-                            thsurf.fset(i, u, th);
-            }
-
-            // UPPER BORDER
-            if (j == y_firstth)
-                for (int u = 0; u<y_firstth; ++u)
-                    thsurf.fset(i + wxh, u, th);
-
-            // LOWER BORDER
-            if (j == y_lastth)
-                for (int u = y_lastth + 1; u<inputMat.rows; ++u)
-                    thsurf.fset(i + wxh, u, th);
-        }
+    sums[0] = 0;
+    squares[0] = 0;
+    for (int c = 0; c < cols; c++) {
+        sums[c + 1] = sums[c] + colSum[c];
+        squares[c + 1] = squares[c] + colSq[c];
+    }
+}
 
-        // RIGHT BORDER
-        for (int i = x_lastth; i<inputMat.cols; ++i)
-            thsurf.fset(i, j, th);
-
-        // RIGHT-UPPER CORNER
-        if (j == y_firstth)
-            for (int u = 0; u<y_firstth; ++u)
-                for (int i = x_lastth; i<inputMat.cols; ++i)
-                    thsurf.fset(i, u, th);
-
-        // RIGHT-LOWER CORNER
-        if (j == y_lastth)
-            for (int u = y_lastth + 1; u<inputMat.rows; ++u)
-                for (int i = x_lastth; i<inputMat.cols; ++i)
-                    thsurf.fset(i, u, th);
+#ifdef DORA_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void localColumnsSlideAVX2(const uchar *added, const uchar *removed, int cols, int32_t *colSum, int32_t *colSq) {
+
+    int c = 0;
+    for (; c + 8 <= cols; c += 8) {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (added + c)));
+        __m256i r = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (removed + c)));
+        __m256i sum = _mm256_loadu_si256((const __m256i *) (colSum + c));
+        __m256i sq = _mm256_loadu_si256((const __m256i *) (colSq + c));
+        sum = _mm256_add_epi32(sum, _mm256_sub_epi32(a, r));
+        sq = _mm256_add_epi32(sq, _mm256_sub_epi32(_mm256_mullo_epi32(a, a), _mm256_mullo_epi32(r, r)));
+        _mm256_storeu_si256((__m256i *) (colSum + c), sum);
+        _mm256_storeu_si256((__m256i *) (colSq + c), sq);
     }
 
-    for (int y = 0; y < inputMat.rows; y++)
-        for (int x = 0; x < inputMat.cols; x++)
-        {
-            if (inputMat.uget(x, y) >= thsurf.fget(x, y))
-            {
-                outputMat.uset(x, y, 255);
-            }
-            else
-            {
-                outputMat.uset(x, y, 0);
-            }
-        }
+    localColumnsSlideScalar(added, removed, c, cols, colSum, colSq);
 }
 
-void bradley_Binarization(Mat &inputMat, Mat &outputMat, float T){
+//Same operations as localStats, four windows at a time (no fused multiply-add, it would change the rounding)
+__attribute__((target("avx2")))
+static inline void localStatsAVX2(const double *sums, const double *squares, int first, const LocalWindow &w, __m256d &m, __m256d &s) {
 
-    int S = (inputMat.cols / 8);
-    float Z = (1.0f - T);
-    int x, y;
-    char sum = 0;
-    int count = 0;
-    int index;
-    int x1, y1, x2, y2;
-    int s2 = S / 2;
+    __m256d area = _mm256_set1_pd(w.area);
+    __m256d sum = _mm256_sub_pd(_mm256_loadu_pd(sums + first + w.winX), _mm256_loadu_pd(sums + first));
+    __m256d sumSq = _mm256_sub_pd(_mm256_loadu_pd(squares + first + w.winX), _mm256_loadu_pd(squares + first));
+    m = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_div_pd(sum, area)));
+    s = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_sqrt_pd(_mm256_div_pd(_mm256_sub_pd(sumSq, _mm256_mul_pd(m, sum)), area))));
+}
 
-    Mat resultMat = Mat(inputMat.size(), CV_8U);
-    Mat integralMat = Mat(inputMat.size(), CV_32F);
-    
-    uchar * input =  inputMat.data;
-    uchar * output = resultMat.data;
-    uchar * integral = integralMat.data;
+template <int METHOD> __attribute__((target("avx2"))) inline __m256d localThresholdAVX2(__m256d m, __m256d s, const LocalThreshold &p);
 
-    //Creates the integral image
-    for (x = 0; x < inputMat.cols; x++)
-    {
-        // reset this column sum
-        sum = 0;
+template <> __attribute__((target("avx2"))) inline __m256d localThresholdAVX2<binarization_NIBLACK>(__m256d m, __m256d s, const LocalThreshold &p) {
+    return _mm256_add_pd(m, _mm256_mul_pd(_mm256_set1_pd(p.k), s));
+}
 
-        for (y = 0; y < inputMat.rows; y++)
-        {
-            index = y * inputMat.cols + x;
+template <> __attribute__((target("avx2"))) inline __m256d localThresholdAVX2<binarization_SAUVOLA>(__m256d m, __m256d s, const LocalThreshold &p) {
+    __m256d t = _mm256_sub_pd(_mm256_div_pd(s, _mm256_set1_pd(p.dR)), _mm256_set1_pd(1));
+    return _mm256_mul_pd(m, _mm256_add_pd(_mm256_set1_pd(1), _mm256_mul_pd(_mm256_set1_pd(p.k), t)));
+}
 
-            sum += input[index];
+template <> __attribute__((target("avx2"))) inline __m256d localThresholdAVX2<binarization_WOLFJOLION>(__m256d m, __m256d s, const LocalThreshold &p) {
+    __m256d t = _mm256_mul_pd(_mm256_set1_pd(p.k), _mm256_sub_pd(_mm256_div_pd(s, _mm256_set1_pd(p.maxS)), _mm256_set1_pd(1)));
+    return _mm256_add_pd(m, _mm256_mul_pd(t, _mm256_sub_pd(m, _mm256_set1_pd(p.minI))));
+}
 
-            if (y == 0)
-                integral[index] = (uchar) sum;
-            else
-                integral[index] = integral[index - 1] + sum;
+//Columns [x, end) whose window is their own, eight at a time. Returns the first column left.
+template <int METHOD> __attribute__((target("avx2")))
+static int localThresholdRowAVX2(const uchar *in, uchar *out, int x, int end, const double *sums, const double *squares,
+                                 const LocalWindow &w, const LocalThreshold &p) {
+
+    for (; x + 8 <= end; x += 8) {
+        __m256d m, s;
+        localStatsAVX2(sums, squares, x - w.wxh, w, m, s);
+        __m128 low = _mm256_cvtpd_ps(localThresholdAVX2<METHOD>(m, s, p));
+        localStatsAVX2(sums, squares, x + 4 - w.wxh, w, m, s);
+        __m128 high = _mm256_cvtpd_ps(localThresholdAVX2<METHOD>(m, s, p));
+
+        __m256 th = _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+        __m256 pixels = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + x))));
+        int white = _mm256_movemask_ps(_mm256_cmp_ps(pixels, th, _CMP_GE_OQ));
+        for (int k = 0; k < 8; k++)
+            out[x + k] = ((white >> k) & 1 ? 255 : 0);
+    }
+
+    return x;
+}
+
+//Largest deviation of the windows [x, end), four at a time. Returns the first window left.
+__attribute__((target("avx2")))
+static int localMaxDeviationRowAVX2(int x, int end, const double *sums, const double *squares, const LocalWindow &w, double &maxS) {
+
+    __m256d best = _mm256_set1_pd(maxS);
+    for (; x + 4 <= end; x += 4) {
+        __m256d m, s;
+        localStatsAVX2(sums, squares, x - w.wxh, w, m, s);
+        best = _mm256_blendv_pd(best, s, _mm256_cmp_pd(s, best, _CMP_GT_OQ));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    for (int k = 0; k < 4; k++)
+        if (lanes[k] > maxS) maxS = lanes[k];
+
+    return x;
+}
+#endif
+
+template <int METHOD>
+static void localThresholdRow(const uchar *in, uchar *out, int cols, const double *sums, const double *squares,
+                              const LocalWindow &w, const LocalThreshold &p, bool simd) {
+
+    float m, s;
+    localStats(sums, squares, 0, w, m, s);
+    float thLeft = (float) localThreshold<METHOD>(m, s, p);
+    localStats(sums, squares, w.cLast - w.wxh, w, m, s);
+    float thRight = (float) localThreshold<METHOD>(m, s, p);
+
+    int x = 0;
+    for (; x < w.wxh && x < cols; x++)
+        out[x] = (in[x] >= thLeft ? 255 : 0);
+
+#ifdef DORA_AVX2_DISPATCH
+    if (simd)
+        x = localThresholdRowAVX2<METHOD>(in, out, x, w.xLast, sums, squares, w, p);
+#endif
+
+    for (; x < w.xLast; x++) {
+        localStats(sums, squares, x - w.wxh, w, m, s);
+        out[x] = (in[x] >= (float) localThreshold<METHOD>(m, s, p) ? 255 : 0);
+    }
+
+    for (; x < cols; x++)
+        out[x] = (in[x] >= thRight ? 255 : 0);
+}
+
+//Moves the column sums to the window centred on row 'centre' (sliding when it is the next row)
+static void localColumnsMove(const Mat &input, const LocalWindow &w, int centre, int previous, int32_t *colSum, int32_t *colSq, bool simd) {
+
+    if (previous < 0 || centre != previous + 1) {
+        localColumnsInit(input, centre - w.wyh, w, colSum, colSq);
+        return;
+    }
+
+    const uchar *added = input.ptr<uchar>(centre - w.wyh + w.winY - 1);
+    const uchar *removed = input.ptr<uchar>(centre - w.wyh - 1);
+
+#ifdef DORA_AVX2_DISPATCH
+    if (simd) {
+        localColumnsSlideAVX2(added, removed, input.cols, colSum, colSq);
+        return;
+    }
+#endif
+    localColumnsSlideScalar(added, removed, 0, input.cols, colSum, colSq);
+}
+
+//Output rows [yStart, yEnd)
+template <int METHOD>
+static void localThresholdStrip(const Mat &input, Mat &output, const LocalWindow &w, const LocalThreshold &p,
+                               int yStart, int yEnd, bool simd) {
+
+    int cols = input.cols;
+    vector<int32_t> colSum(cols), colSq(cols);
+    vector<double> sums(cols + 1), squares(cols + 1);
+    int centre = -1;
+
+    for (int y = yStart; y < yEnd; y++) {
+        int c = min(max(y, w.yFirst), w.yLast);
+        if (c != centre) {
+            localColumnsMove(input, w, c, centre, colSum.data(), colSq.data(), simd);
+            localPrefix(colSum.data(), colSq.data(), cols, sums.data(), squares.data());
+            centre = c;
         }
+        localThresholdRow<METHOD>(input.ptr<uchar>(y), output.ptr<uchar>(y), cols, sums.data(), squares.data(), w, p, simd);
     }
+}
 
-    //perform thresholding
-    for (x = 0; x < inputMat.cols; x++)
-    {
-        for (y = 0; y < inputMat.rows; y++)
-        {
-            index = y * inputMat.cols + x;
+//Largest deviation of the windows centred on rows [cStart, cEnd) (Wolf-Jolion normalizes by it)
+static double localMaxDeviationStrip(const Mat &input, const LocalWindow &w, int cStart, int cEnd, bool simd) {
+
+    int cols = input.cols;
+    vector<int32_t> colSum(cols), colSq(cols);
+    vector<double> sums(cols + 1), squares(cols + 1);
+    double maxS = 0;
+
+    for (int c = cStart; c < cEnd; c++) {
+        localColumnsMove(input, w, c, (c == cStart ? -1 : c - 1), colSum.data(), colSq.data(), simd);
+        localPrefix(colSum.data(), colSq.data(), cols, sums.data(), squares.data());
+
+        int x = w.wxh;
+#ifdef DORA_AVX2_DISPATCH
+        if (simd)
+            x = localMaxDeviationRowAVX2(x, w.cLast + 1, sums.data(), squares.data(), w, maxS);
+#endif
+        for (; x <= w.cLast; x++) {
+            float m, s;
+            localStats(sums.data(), squares.data(), x - w.wxh, w, m, s);
+            if (s > maxS) maxS = s;
+        }
+    }
+
+    return maxS;
+}
+
+template <int METHOD>
+class LocalThresholdBody : public ParallelLoopBody {
+    const Mat               &mInput;
+    Mat                     &mOutput;
+    const LocalWindow       &mWindow;
+    const LocalThreshold    &mThreshold;
+    bool                    mSIMD;
+
+public:
+    LocalThresholdBody(const Mat &input, Mat &output, const LocalWindow &w, const LocalThreshold &p, bool simd)
+            : mInput(input), mOutput(output), mWindow(w), mThreshold(p), mSIMD(simd) {}
 
-            //set the SxS region
-            x1 = x - s2; x2 = x + s2;
-            y1 = y - s2; y2 = y + s2;
+    void operator()(const Range &range) const {
+        localThresholdStrip<METHOD>(mInput, mOutput, mWindow, mThreshold, range.start, range.end, mSIMD);
+    }
+};
+
+class LocalMaxDeviationBody : public ParallelLoopBody {
+    const Mat           &mInput;
+    const LocalWindow   &mWindow;
+    bool                mSIMD;
+    double              &mMaxS;
+    mutex               &mMutex;
+
+public:
+    LocalMaxDeviationBody(const Mat &input, const LocalWindow &w, bool simd, double &maxS, mutex &m)
+            : mInput(input), mWindow(w), mSIMD(simd), mMaxS(maxS), mMutex(m) {}
+
+    void operator()(const Range &range) const {
+        double maxS = localMaxDeviationStrip(mInput, mWindow, range.start, range.end, mSIMD);
+        lock_guard<mutex> lock(mMutex);
+        if (maxS > mMaxS) mMaxS = maxS;
+    }
+};
+
+template <int METHOD>
+static void localThresholdImage(const Mat &input, Mat &output, const LocalWindow &w, const LocalThreshold &p, bool simd) {
+
+    LocalThresholdBody<METHOD> body(input, output, w, p, simd);
+    runStrips(Range(0, input.rows), input.total(), body, w.winY);
+}
+
+void NiblackSauvolaWolfJolion(Mat inputMat, Mat &outputMat, enumBinarization method, int winX, int winY, double k, double dR) {
 
-            //check the border
-            if (x1 < 0) x1 = 0;
-            if (x2 >= inputMat.cols) x2 = inputMat.cols - 1;
-            if (y1 < 0) y1 = 0;
-            if (y2 >= inputMat.rows) y2 = inputMat.rows - 1;
+    CV_Assert(inputMat.type() == CV_8UC1);
+    if (inputMat.empty())
+        return;
+
+    //Empty windows, windows larger than the image, and even windows as tall as the image used to read
+    //outside the integral images: they are trimmed to the largest window that has a centre row
+    winX = min(max(winX, 1), inputMat.cols);
+    winY = min(max(winY, 1), inputMat.rows);
+    if (winY % 2 == 0 && winY == inputMat.rows)
+        winY--;
+
+    LocalWindow w = getLocalWindow(inputMat.rows, inputMat.cols, winX, winY);
+    LocalThreshold p = {k, dR, 0, 0};
+    bool simd = isBinarizationSIMD();
+
+    if (method == binarization_WOLFJOLION) {
+        double min_I, max_I;
+        minMaxLoc(inputMat, &min_I, &max_I);
+        p.minI = min_I;
+
+        mutex maxMutex;
+        LocalMaxDeviationBody body(inputMat, w, simd, p.maxS, maxMutex);
+        runStrips(Range(w.yFirst, w.yLast + 1), inputMat.total(), body, w.winY);
+    }
 
-            count = (x2 - x1)*(y2 - y1);
+    Mat resultMat = getStripOutput(inputMat, outputMat);
+
+    switch (method) {
+        case binarization_NIBLACK:
+            localThresholdImage<binarization_NIBLACK>(inputMat, resultMat, w, p, simd);
+            break;
+        case binarization_SAUVOLA:
+            localThresholdImage<binarization_SAUVOLA>(inputMat, resultMat, w, p, simd);
+            break;
+        case binarization_WOLFJOLION:
+            localThresholdImage<binarization_WOLFJOLION>(inputMat, resultMat, w, p, simd);
+            break;
+        default:
+            return;
+    }
+
+    outputMat = resultMat;
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+// Bradley & Roth adaptive thresholding: a pixel is black when it is more than T darker than the mean of the SxS
+// window around it (S is a eighth of the image width). The window of row y covers rows (y1, y2], so each strip of
+// rows keeps the uint32 sums of those rows for every column, sliding them as y moves down, and a running prefix
+// of the sums along the row gives any horizontal window. The sums wrap modulo 2^32, which keeps the differences
+// exact for any image size. Pixels are compared eight at a time with AVX2 when the cpu has it; both paths do the
+// same float operations and give the same output.
+//---------------------------------------------------------------------------------------------------------------------------
+
+static void bradleyColumnsSlideScalar(const uchar *added, const uchar *removed, int first, int cols, uint32_t *colSum) {
+
+    for (int c = first; c < cols; c++)
+        colSum[c] += added[c] - removed[c];
+}
 
-            //I(x,y) = s(x2,y2) - s(x1,y2) - s(x2,y1) + s(x1,x1)
-            sum = integral[y2 * inputMat.cols + x2] -
-                  integral[y1 * inputMat.cols + x2] -
-                  integral[y2 * inputMat.cols + x1] +
-                  integral[y1 * inputMat.cols + x1];
+static void bradleyPrefix(const uint32_t *colSum, int cols, uint32_t *prefix) {
 
-            if (input[index] * count < (sum * Z))
-                output[index] = 0;
+    prefix[0] = 0;
+    for (int c = 0; c < cols; c++)
+        prefix[c + 1] = prefix[c] + colSum[c];
+}
+
+//Thresholds pixels [first, last) of a row. top and bottom are the rows y1 + 1 and y2 + 1 of an integral
+//image; the strips pass a row of zeros and the prefix of their column sums, which is the same difference.
+static void bradleyRowScalar(const uchar *in, uchar *out, const uint32_t *top, const uint32_t *bottom,
+                             int cols, int first, int last, int s2, int height, float Z) {
+
+    for (int x = first; x < last; x++) {
+        int x1 = (x - s2 < 0 ? 0 : x - s2);
+        int x2 = (x + s2 >= cols ? cols - 1 : x + s2);
+        int count = (x2 - x1) * height;
+        uint32_t sum = bottom[x2 + 1] - top[x2 + 1] - bottom[x1 + 1] + top[x1 + 1];
+
+        out[x] = ((float) (int32_t) (in[x] * (uint32_t) count) < (float) (int32_t) sum * Z ? 0 : 255);
+    }
+}
+
+#ifdef DORA_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void bradleyColumnsSlideAVX2(const uchar *added, const uchar *removed, int cols, uint32_t *colSum) {
+
+    int c = 0;
+    for (; c + 8 <= cols; c += 8) {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (added + c)));
+        __m256i r = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (removed + c)));
+        __m256i sum = _mm256_loadu_si256((const __m256i *) (colSum + c));
+        _mm256_storeu_si256((__m256i *) (colSum + c), _mm256_add_epi32(sum, _mm256_sub_epi32(a, r)));
+    }
+
+    bradleyColumnsSlideScalar(added, removed, c, cols, colSum);
+}
+
+//Inside [s2, cols - s2) the window is never clipped horizontally: the count is the same for the whole row
+//and the four corners are plain unaligned loads. The borders go through the scalar code.
+__attribute__((target("avx2")))
+static void bradleyRowAVX2(const uchar *in, uchar *out, const uint32_t *top, const uint32_t *bottom,
+                           int cols, int s2, int height, float Z) {
+
+    int first = min(s2, cols);
+    int last = max(cols - s2, first);
+    int x = first;
+
+    const __m256i count = _mm256_set1_epi32(2 * s2 * height);
+    const __m256 z = _mm256_set1_ps(Z);
+
+    for (; x + 8 <= last; x += 8) {
+        __m256i sum = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) (bottom + x + s2 + 1)),
+                                       _mm256_loadu_si256((const __m256i *) (top + x + s2 + 1)));
+        sum = _mm256_sub_epi32(sum, _mm256_loadu_si256((const __m256i *) (bottom + x - s2 + 1)));
+        sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i *) (top + x - s2 + 1)));
+
+        __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (in + x)));
+        __m256 lhs = _mm256_cvtepi32_ps(_mm256_mullo_epi32(pixels, count));
+        __m256 rhs = _mm256_mul_ps(_mm256_cvtepi32_ps(sum), z);
+
+        //lanes that are not darker than the threshold become 255
+        int black = _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ));
+        for (int k = 0; k < 8; k++)
+            out[x + k] = ((black >> k) & 1 ? 0 : 255);
+    }
+
+    bradleyRowScalar(in, out, top, bottom, cols, 0, first, s2, height, Z);
+    bradleyRowScalar(in, out, top, bottom, cols, x, cols, s2, height, Z);
+}
+#endif
+
+//Output rows [yStart, yEnd). The first row of the strip adds its whole window (the halo), the next ones
+//add the row entering the window and remove the row leaving it.
+static void bradleyStrip(const Mat &input, Mat &output, int s2, float Z, int yStart, int yEnd, bool simd) {
+
+    int rows = input.rows;
+    int cols = input.cols;
+    vector<uint32_t> colSum(cols, 0), prefix(cols + 1), zeros(cols + 1, 0);
+    vector<uchar> none(cols, 0);
+    int top = -1, bottom = -1;  //colSum holds rows (top, bottom]
+
+    for (int y = yStart; y < yEnd; y++) {
+        int y1 = (y - s2 < 0 ? 0 : y - s2);
+        int y2 = (y + s2 >= rows ? rows - 1 : y + s2);
+
+        if (top < 0)
+            top = bottom = y1;
+
+        while (bottom < y2 || top < y1) {
+            const uchar *added = (bottom < y2 ? input.ptr<uchar>(++bottom) : none.data());
+            const uchar *removed = (top < y1 ? input.ptr<uchar>(++top) : none.data());
+#ifdef DORA_AVX2_DISPATCH
+            if (simd)
+                bradleyColumnsSlideAVX2(added, removed, cols, colSum.data());
             else
-                output[index] = 255;
+#endif
+                bradleyColumnsSlideScalar(added, removed, 0, cols, colSum.data());
         }
+        bradleyPrefix(colSum.data(), cols, prefix.data());
+
+#ifdef DORA_AVX2_DISPATCH
+        if (simd) {
+            bradleyRowAVX2(input.ptr<uchar>(y), output.ptr<uchar>(y), zeros.data(), prefix.data(), cols, s2, y2 - y1, Z);
+            continue;
+        }
+#endif
+        bradleyRowScalar(input.ptr<uchar>(y), output.ptr<uchar>(y), zeros.data(), prefix.data(), cols, 0, cols, s2, y2 - y1, Z);
+    }
+}
+
+class BradleyBody : public ParallelLoopBody {
+    const Mat       &mInput;
+    Mat             &mOutput;
+    int             mS2;
+    float           mZ;
+    bool            mSIMD;
+
+public:
+    BradleyBody(const Mat &input, Mat &output, int s2, float Z, bool simd)
+            : mInput(input), mOutput(output), mS2(s2), mZ(Z), mSIMD(simd) {}
+
+    void operator()(const Range &range) const {
+        bradleyStrip(mInput, mOutput, mS2, mZ, range.start, range.end, mSIMD);
     }
+};
+
+void bradley_Binarization(Mat &inputMat, Mat &outputMat, float T){
+
+    CV_Assert(inputMat.type() == CV_8UC1);
+
+    int S = (inputMat.cols / 8);
+    int s2 = S / 2;
+    float Z = (1.0f - T);
+
+    Mat resultMat = getStripOutput(inputMat, outputMat);
+    BradleyBody body(inputMat, resultMat, s2, Z, isBinarizationSIMD());
+    runStrips(Range(0, inputMat.rows), inputMat.total(), body, 2 * s2 + 1);
 
-    //Retorna o Mat binário
-    resultMat.copyTo(outputMat);
+    outputMat = resultMat;
 }
 
 bool binarize(Mat &sourceMat, Mat &destMat, enumBinarization method){
@@ -265,7 +604,9 @@ bool binarize(Mat &sourceMat, Mat &destMat, enumBinarization method){
     }
     
     //Make sure the outputMat is the same size as the inputMat, but with reduced depth
-    destMat = Mat(sourceMat.rows, sourceMat.cols, CV_8U, Scalar::all(255));
+    preparePooledMat(destMat);
+    destMat.create(sourceMat.rows, sourceMat.cols, CV_8U);
+    destMat.setTo(Scalar::all(255));
     
     switch (method) {
 
@@ -311,8 +652,11 @@ bool binarize(Mat &sourceMat, Mat &destMat, enumBinarization method){
         {
             K = 0.2;
             double DR = 128;
-            NiblackSauvolaWolfJolion(~sourceMat, destMat, binarization_NIBLACK, windowWidth, windowHeight, K, DR);
-            destMat = ~destMat;
+            Mat invertedMat;
+            preparePooledMat(invertedMat);
+            bitwise_not(sourceMat, invertedMat);
+            NiblackSauvolaWolfJolion(invertedMat, destMat, binarization_NIBLACK, windowWidth, windowHeight, K, DR);
+            bitwise_not(destMat, destMat);
         }
         break;
 
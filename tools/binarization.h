@@ -32,4 +32,12 @@ enum enumBinarization
 
 bool binarize(Mat &source, Mat &dest, enumBinarization method);
 
+void NiblackSauvolaWolfJolion(Mat inputMat, Mat &outputMat, enumBinarization method, int winX, int winY, double k, double dR);
+
+void bradley_Binarization(Mat &inputMat, Mat &outputMat, float T);
+
+//SIMD kernels are used when the cpu has them, unless turned off (to compare or benchmark the scalar code)
+void setBinarizationSIMD(bool enabled);
+bool isBinarizationSIMD();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,392 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "filereader.h"
+#include "metrics.h"
+#include "trace.h"
+
+#ifdef DORA_WITH_URING
+#include <liburing.h>
+#endif
+
+#define READER_MAX_THREADS  64
+
+BufferPool::BufferPool(size_t maxFree) {
+    mMaxFree = maxFree;
+}
+
+//Hands out a buffer that keeps the capacity of the last file it held
+vector<uchar> BufferPool::acquire() {
+
+    lock_guard<mutex> lock(mMutex);
+
+    vector<uchar> buffer;
+    if (!mFree.empty()) {
+        buffer.swap(mFree.back());
+        mFree.pop_back();
+    }
+    return buffer;
+}
+
+void BufferPool::release(vector<uchar> &buffer) {
+
+    lock_guard<mutex> lock(mMutex);
+
+    if (mFree.size() < mMaxFree) {
+        buffer.clear();
+        mFree.push_back(vector<uchar>());
+        mFree.back().swap(buffer);
+    }
+    else
+        vector<uchar>().swap(buffer);
+}
+
+//Reads the whole file into 'data' (resized to the file size)
+bool readWholeFile(string filename, vector<uchar> &data) {
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool res = false;
+    struct stat s;
+
+    if (fstat(fd, &s) == 0 && s.st_size > 0) {
+
+        data.resize((size_t) s.st_size);
+        size_t offset = 0;
+
+        while (offset < data.size()) {
+            ssize_t count = read(fd, data.data() + offset, data.size() - offset);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                break;
+            offset += (size_t) count;
+        }
+
+        data.resize(offset);
+        res = (offset > 0);
+    }
+
+    close(fd);
+    return res;
+}
+
+BatchFileReader::BatchFileReader(int depth) {
+
+    //Initialize the internal variables
+    mDepth = (depth > 0 ? depth : 1);
+    mUring = false;
+    mRing = NULL;
+    mBatch = NULL;
+    mNext = 0;
+    mPending = 0;
+    mStopping = false;
+
+#ifdef DORA_WITH_URING
+    struct io_uring *ring = new struct io_uring;
+    int res = io_uring_queue_init((unsigned) mDepth, ring, 0);
+    if (res == 0) {
+        mRing = ring;
+        mUring = true;
+        Log(log_Detail, "filereader.cpp", "BatchFileReader", "      Reading files through io_uring (%i reads in flight).", mDepth);
+        return;
+    }
+    delete ring;
+    Log(log_Warning, "filereader.cpp", "BatchFileReader", "      io_uring is not available (%s), using reader threads.", strerror(-res));
+#endif
+
+    int threadCount = min(mDepth, READER_MAX_THREADS);
+    for (int t = 0; t < threadCount; t++)
+        mThreads.push_back(thread(&BatchFileReader::readerThread, this, t));
+
+    Log(log_Detail, "filereader.cpp", "BatchFileReader", "      Reading files through %i reader threads.", threadCount);
+}
+
+BatchFileReader::~BatchFileReader() {
+
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWork.notify_all();
+
+    for (size_t t = 0; t < mThreads.size(); t++)
+        mThreads[t].join();
+
+#ifdef DORA_WITH_URING
+    if (mRing != NULL) {
+        io_uring_queue_exit((struct io_uring *) mRing);
+        delete (struct io_uring *) mRing;
+    }
+#endif
+}
+
+int BatchFileReader::getDepth() {
+    return mDepth;
+}
+
+bool BatchFileReader::isUsingUring() {
+    return mUring;
+}
+
+//Reads every file of the batch into its buffer, at most 'depth' at a time. 'ok' tells which ones succeeded.
+void BatchFileReader::readBatch(vector<FileRead> &batch) {
+
+    for (size_t i = 0; i < batch.size(); i++)
+        batch[i].ok = false;
+
+    if (mUring && batch.size() <= (size_t) mDepth && readBatchUring(batch))
+        return;
+
+    if (mThreads.empty()) {
+        //io_uring failed for this batch and there is no thread pool: read what is left one file at a time
+        for (size_t i = 0; i < batch.size(); i++)
+            if (!batch[i].ok)
+                batch[i].ok = readWholeFile(batch[i].filename, batch[i].data);
+        return;
+    }
+
+    readBatchThreads(batch);
+}
+
+void BatchFileReader::readBatchThreads(vector<FileRead> &batch) {
+
+    unique_lock<mutex> lock(mMutex);
+    mBatch = &batch;
+    mNext = 0;
+    mPending = batch.size();
+    mWork.notify_all();
+
+    mDone.wait(lock, [this] { return mPending == 0; });
+    mBatch = NULL;
+}
+
+void BatchFileReader::readerThread(int index) {
+
+    setTraceThreadName("reader " + to_string(index + 1));
+
+    unique_lock<mutex> lock(mMutex);
+
+    while (true) {
+        mWork.wait(lock, [this] { return mStopping || (mBatch != NULL && mNext < mBatch->size()); });
+        if (mStopping)
+            return;
+
+        //the batch stays put until every read was accounted for
+        FileRead &file = (*mBatch)[mNext++];
+
+        lock.unlock();
+        file.ok = readWholeFile(file.filename, file.data);
+        lock.lock();
+
+        if (--mPending == 0)
+            mDone.notify_one();
+    }
+}
+
+#ifdef DORA_WITH_URING
+#define URING_CANCEL_TAG    ((void *) ~(uintptr_t) 0)   //user data of the cancel requests
+
+//Waits for the next completion, again when a signal interrupts the wait
+static int waitCompletion(struct io_uring *ring, struct io_uring_cqe **cqe) {
+
+    int res;
+    do {
+        res = io_uring_wait_cqe(ring, cqe);
+    } while (res == -EINTR);
+
+    return res;
+}
+
+//Cancels the requests still in flight and waits until the kernel is done with every one of them, so no buffer
+//of the batch is written once readBatchUring returns. Opens that complete anyway get their file closed.
+//Returns false when the ring stopped answering.
+static bool cancelPending(struct io_uring *ring, vector<bool> &pending, bool opening) {
+
+    size_t inFlight = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (!pending[i])
+            continue;
+        inFlight++;
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (sqe != NULL) {
+            io_uring_prep_cancel(sqe, (void *) i, 0);
+            io_uring_sqe_set_data(sqe, URING_CANCEL_TAG);
+        }
+    }
+    io_uring_submit(ring);
+
+    while (inFlight > 0) {
+        struct io_uring_cqe *cqe;
+        if (waitCompletion(ring, &cqe) < 0)
+            return false;
+        void *data = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+
+        if (data == URING_CANCEL_TAG || !pending[(size_t) data])
+            continue;
+        pending[(size_t) data] = false;
+        inFlight--;
+        if (opening && res >= 0)
+            close(res);
+    }
+
+    return true;
+}
+#endif
+
+//When a wait fails the requests in flight are cancelled, and if even that fails the ring is given up for good:
+//the buffers it may still write are kept aside (never handed out) and later batches use plain reads.
+void BatchFileReader::abandonUring(vector<FileRead> &batch, vector<bool> &pending) {
+
+    Log(log_Warning, "filereader.cpp", "abandonUring", "      io_uring stopped answering, using plain reads.");
+    mUring = false;
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i]) {
+            mOrphans.push_back(vector<uchar>());
+            mOrphans.back().swap(batch[i].data);
+        }
+    }
+}
+
+//One submission opens the whole batch, a second one reads it. Returns false when files were left unread
+//(the ring could not be used, or stopped answering) so the caller reads them another way.
+bool BatchFileReader::readBatchUring(vector<FileRead> &batch) {
+
+#ifdef DORA_WITH_URING
+    struct io_uring *ring = (struct io_uring *) mRing;
+    size_t count = batch.size();
+    vector<int> fds(count, -1);
+    vector<size_t> offsets(count, 0);
+    vector<bool> pending(count, false);
+    size_t inFlight = 0;
+    bool res = true;
+
+    //1) opens
+    for (size_t i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (sqe == NULL)
+            break;
+        io_uring_prep_openat(sqe, AT_FDCWD, batch[i].filename.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        io_uring_sqe_set_data(sqe, (void *) i);
+        pending[i] = true;
+        inFlight++;
+    }
+
+    //nothing was submitted, the prepared requests would go with the next submission: the ring is not used again
+    if (io_uring_submit(ring) < 0) {
+        mUring = false;
+        return false;
+    }
+
+    while (inFlight > 0) {
+        struct io_uring_cqe *cqe;
+        if (waitCompletion(ring, &cqe) < 0) {
+            if (!cancelPending(ring, pending, true))
+                abandonUring(batch, pending);
+            inFlight = 0;
+            res = false;
+            break;
+        }
+        size_t i = (size_t) io_uring_cqe_get_data(cqe);
+        fds[i] = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+        pending[i] = false;
+        inFlight--;
+
+        //kernels before 5.6 have no IORING_OP_OPENAT
+        if (fds[i] == -EINVAL || fds[i] == -EOPNOTSUPP)
+            fds[i] = open(batch[i].filename.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    //2) sizes the buffers (one fstat per file) and queues the reads
+    for (size_t i = 0; i < count && res; i++) {
+        struct stat s;
+        if (fds[i] < 0 || fstat(fds[i], &s) != 0 || s.st_size <= 0)
+            continue;
+
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (sqe == NULL)
+            break;
+
+        batch[i].data.resize((size_t) s.st_size);
+        io_uring_prep_read(sqe, fds[i], batch[i].data.data(), (unsigned) batch[i].data.size(), 0);
+        io_uring_sqe_set_data(sqe, (void *) i);
+        pending[i] = true;
+        inFlight++;
+    }
+
+    if (inFlight > 0 && io_uring_submit(ring) < 0) {
+        mUring = false;
+        pending.assign(count, false);
+        inFlight = 0;
+        res = false;
+    }
+
+    //3) completions; short reads are queued again for the rest of the file
+    while (inFlight > 0) {
+        struct io_uring_cqe *cqe;
+        if (waitCompletion(ring, &cqe) < 0) {
+            if (!cancelPending(ring, pending, false))
+                abandonUring(batch, pending);
+            res = false;
+            break;
+        }
+        size_t i = (size_t) io_uring_cqe_get_data(cqe);
+        int length = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+        pending[i] = false;
+        inFlight--;
+
+        if (length > 0)
+            offsets[i] += (size_t) length;
+
+        bool retry = (length == -EAGAIN || length == -EINTR);
+        if (mUring && ((length > 0 && offsets[i] < batch[i].data.size()) || retry)) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            if (sqe != NULL) {
+                io_uring_prep_read(sqe, fds[i], batch[i].data.data() + offsets[i], (unsigned) (batch[i].data.size() - offsets[i]), offsets[i]);
+                io_uring_sqe_set_data(sqe, (void *) i);
+                if (io_uring_submit(ring) >= 0) {
+                    pending[i] = true;
+                    inFlight++;
+                    continue;
+                }
+
+                //the request stays in the submission queue: its buffer is kept aside and the ring is not used again
+                mUring = false;
+                mOrphans.push_back(vector<uchar>());
+                mOrphans.back().swap(batch[i].data);
+                res = false;
+                continue;
+            }
+        }
+
+        //done: complete file, end of file or error. A read cut short is left to the caller
+        bool complete = (length == 0 || offsets[i] == batch[i].data.size());
+        batch[i].data.resize(offsets[i]);
+        batch[i].ok = (offsets[i] > 0 && length >= 0 && complete);
+        if (length > 0 && !complete)
+            res = false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+
+    return res;
+#else
+    (void) batch;
+    return false;
+#endif
+}
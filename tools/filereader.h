@@ -0,0 +1,84 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Batched file reader used by the sample loader. Whole files are read into
+// memory with many reads in flight at once, so ingest from network storage is
+// bound by bandwidth instead of by one round trip per file:
+//
+//   - io_uring (when dora is built with DORA_WITH_URING): one submission for
+//     the opens of the whole batch, then one for all the reads;
+//   - otherwise a pool of reader threads doing plain open()/read().
+//
+// The buffers come from a BufferPool, so steady state ingest does not
+// allocate (or page fault) a new buffer for every file.
+//
+
+#ifndef DORA_FILEREADER_H
+#define DORA_FILEREADER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <opencv2/core.hpp>
+#include "helper.h"
+
+using namespace std;
+
+class BufferPool {
+    vector<vector<uchar> >  mFree;
+    size_t                  mMaxFree;
+    mutex                   mMutex;
+
+public:
+    explicit BufferPool(size_t maxFree);
+
+    vector<uchar>   acquire();
+    void            release(vector<uchar> &buffer);
+};
+
+struct FileRead {
+    string          filename;
+    vector<uchar>   data;
+    bool            ok;
+};
+
+class BatchFileReader {
+    int             mDepth;
+    bool            mUring;
+    void           *mRing;
+
+    //fallback thread pool
+    vector<thread>      mThreads;
+    mutex               mMutex;
+    condition_variable  mWork;
+    condition_variable  mDone;
+    vector<FileRead>   *mBatch;
+    size_t              mNext;
+    size_t              mPending;
+    bool                mStopping;
+
+    vector<vector<uchar> >  mOrphans;   //buffers an abandoned ring may still write, never handed out again
+
+    bool            readBatchUring(vector<FileRead> &batch);
+    void            abandonUring(vector<FileRead> &batch, vector<bool> &pending);
+    void            readBatchThreads(vector<FileRead> &batch);
+    void            readerThread(int index);
+
+public:
+    //Constructors
+    explicit BatchFileReader(int depth);
+    ~BatchFileReader();
+
+    //Methods
+    void            readBatch(vector<FileRead> &batch);
+
+    //Getters
+    int             getDepth();
+    bool            isUsingUring();
+};
+
+bool readWholeFile(string filename, vector<uchar> &data);
+
+#endif
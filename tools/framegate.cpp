@@ -0,0 +1,80 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <opencv2/imgproc.hpp>
+#include "framegate.h"
+
+FrameGate::FrameGate(double threshold) {
+    mThreshold = threshold;
+}
+
+void FrameGate::reset() {
+    mReference.release();
+    mCandidate.release();
+}
+
+//A threshold of zero (or less) lets every frame through
+bool FrameGate::hasChanged(const Mat &frame) {
+
+    if (mThreshold <= 0 || !isMatValid(frame))
+        return true;
+
+    //the colour conversion runs on the thumbnail, not on the frame
+    Mat thumbnail;
+    resize(frame, thumbnail, Size(FRAMEGATE_SIZE, FRAMEGATE_SIZE), 0, 0, INTER_AREA);
+    if (thumbnail.channels() == 3)
+        cvtColor(thumbnail, thumbnail, COLOR_BGR2GRAY);
+    else if (thumbnail.channels() == 4)
+        cvtColor(thumbnail, thumbnail, COLOR_BGRA2GRAY);
+
+    if (!mReference.empty() && norm(thumbnail, mReference, NORM_L1) / thumbnail.total() < mThreshold)
+        return false;
+
+    mCandidate = thumbnail;
+    return true;
+}
+
+//Makes the last frame that passed the reference the next ones are compared to
+void FrameGate::accept() {
+    if (!mCandidate.empty())
+        mReference = mCandidate;
+    mCandidate.release();
+}
+
+LabelSmoother::LabelSmoother(int window) {
+    mWindow = (size_t) max(window, 1);
+}
+
+void LabelSmoother::reset() {
+    mHistory.clear();
+}
+
+void LabelSmoother::add(int label) {
+    mHistory.push_back(label);
+    if (mHistory.size() > mWindow)
+        mHistory.pop_front();
+}
+
+//Votes again for the last prediction (the frame it was made on did not change)
+void LabelSmoother::repeat() {
+    if (!mHistory.empty())
+        add(mHistory.back());
+}
+
+//-1 until a prediction was added
+int LabelSmoother::getLabel() {
+
+    int best = -1;
+    int bestVotes = 0;
+
+    //newest first, so on ties the most recent label wins
+    for (deque<int>::reverse_iterator it = mHistory.rbegin(); it != mHistory.rend(); ++it) {
+        int votes = (int) count(mHistory.begin(), mHistory.end(), *it);
+        if (votes > bestVotes) {
+            best = *it;
+            bestVotes = votes;
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,59 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Helpers for classifying frame streams (camera, video files).
+//
+// FrameGate tells whether a frame differs enough from the last one that was
+// classified: both are reduced to a 16x16 grayscale thumbnail and compared by
+// their mean absolute difference (in gray levels). The reference only moves
+// when a frame that passed the gate is accepted (it was classified), so slow
+// drifts still add up and trigger it, and a frame that failed to classify
+// leaves the gate open for the next one.
+//
+// LabelSmoother is a majority vote over the last frames, which removes the
+// single-frame label flicker of the SVM. A frame the gate held back repeats
+// the last prediction, so votes are counted per frame and a new stable scene
+// takes over once it fills half the window. Ties go to the most recent one.
+//
+
+#ifndef DORA_FRAMEGATE_H
+#define DORA_FRAMEGATE_H
+
+#include <deque>
+#include "helper.h"
+
+using namespace std;
+
+#define FRAMEGATE_SIZE  16
+
+class FrameGate {
+    Mat     mReference;
+    Mat     mCandidate;     //thumbnail of the last frame that passed, see accept()
+    double  mThreshold;
+
+public:
+    //Constructors
+    explicit FrameGate(double threshold);
+
+    //Methods
+    bool    hasChanged(const Mat &frame);
+    void    accept();
+    void    reset();
+};
+
+class LabelSmoother {
+    deque<int>  mHistory;
+    size_t      mWindow;
+
+public:
+    //Constructors
+    explicit LabelSmoother(int window);
+
+    //Methods
+    void    add(int label);
+    void    repeat();
+    int     getLabel();
+    void    reset();
+};
+
+#endif
@@ -8,11 +8,12 @@
 //
 
 //TODO: Check out if compiler variables would work on both windows and linux
-//TODO: Improve logging and the log levels
 //
 
 #include <list>
+#include <errno.h>
 #include "helper.h"
+#include "logger.h"
 
 using namespace std;
 
@@ -22,8 +23,6 @@ using namespace std;
 //	3; errors, warnings, debug and details
 int log_level = 2;
 
-string log_filename = "log.txt";
-
 string getLogMode(){
 	switch (log_level){
 		case 0:	return "errors only";
@@ -31,52 +30,25 @@ string getLogMode(){
 		case 2: return "errors, warnings and debug";
 		case 3:	return "errors, warnings, debug and details (might affect performance)";
 	}
+	return "unknown";
+}
+
+void setLogLevel(int level){
+	log_level = (level < log_Error ? log_Error : (level > log_Detail ? log_Detail : level));
 }
 
-void Log(logMode mode, string moduleName, string procedureName, string information, ...){
+void logRecord(logMode mode, const char *moduleName, const char *procedureName, const char *information, ...){
 
-	char info[256];
+	//Formats the record straight into the logger's ring buffer. The flush thread
+	//prints it, adds the timestamp and appends it to the log file.
 	va_list args;
 	va_start (args, information);
-	vsprintf (info, information.c_str(), args);
+	pushLogRecord(mode, moduleName, procedureName, information, args);
 	va_end (args);
-	information = info;
-
-	if(log_level >= mode) {
-
-		string buffer = "";
-
-		//Formata o nome do module com 18 chars
-		moduleName.append("                  ");
-		moduleName = moduleName.substr(0, 18);
-
-		//Formata o nome da procedure com 20 chars
-		procedureName.append("                    ");
-		procedureName = procedureName.substr(0, 22);
-
-		//Monta o texto que será logado
-		buffer = moduleName + " | " + procedureName + " | ";
-
-		buffer += information + "\n";
-
-		//Exibe a string no console
-		printf("%s", buffer.c_str());
-
-		//Concatena o horário no buffer
-		buffer = string(getCurrentTimeStamp()) + string(" | ").c_str() + buffer.c_str();
-
-		//Abre o arquivo para append
-		_IO_FILE *fp;
-		fp = fopen(log_filename.c_str(), "a+");
-		if (NULL != fp) {
-
-			//Adiciona o texto no arquivo
-			fprintf(fp, "%s", buffer.c_str());
+}
 
-			//Fecha o arquivo
-			fclose(fp);
-		}
-	}
+void logRecord(logMode mode, const char *moduleName, const char *procedureName, const string &information){
+	logRecord(mode, moduleName, procedureName, "%s", information.c_str());
 }
 
 bool isFile(string path){
@@ -135,6 +107,24 @@ bool isFolder(string path){
 
 }
 
+bool createFolder(string path){
+
+	Log(log_Detail, "helper.cpp", "createFolder", "   Creating folder '%s'...", path.c_str());
+
+	try {
+		if (isFolder(path) || mkdir(path.c_str(), 0755) == 0)
+			return true;
+
+		Log(log_Error, "helper.cpp", "createFolder", "      Failed to create folder '%s': %s", path.c_str(), strerror(errno));
+
+	}catch(const std::exception& e){
+		Log(log_Error, "helper.cpp", "createFolder", "      Failed to create folder: %s", e.what() ) ;
+	}
+
+	return false;
+
+}
+
 string toLower(string input){
 
 	string res = input;
@@ -266,6 +256,20 @@ vector<string> listFiles(string folder){
 
 }
 
+//64 bit FNV-1a. 'seed' chains calls, so several buffers can be hashed as one.
+uint64_t getHash(const void *data, size_t length, uint64_t seed){
+
+	const unsigned char *p = (const unsigned char *) data;
+	uint64_t hash = (seed != 0 ? seed : 14695981039346656037ULL);
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
 bool isMatValid(Mat m){
 
     bool bRet = (m.rows > 0 && m.cols > 0 && m.channels() > 0 && !m.empty());
@@ -30,15 +30,34 @@ enum logMode{
 	log_Detail =3
 };
 
+//Highest level compiled into the binary (set by the DORA_LOG_LEVEL cmake option).
+//Log() calls above it are removed by the compiler, arguments included.
+#ifndef DORA_LOG_MAX_LEVEL
+#define DORA_LOG_MAX_LEVEL 3
+#endif
+
+extern int log_level;
+
 string getLogMode();
-void Log(logMode mode, string moduleName, string procedureName, string information, ...);
+void setLogLevel(int level);
+
+void logRecord(logMode mode, const char *moduleName, const char *procedureName, const char *information, ...);
+void logRecord(logMode mode, const char *moduleName, const char *procedureName, const string &information);
+
+//Both levels are checked before any of the arguments is evaluated, so a filtered
+//out call costs one compare (or nothing, when it is above DORA_LOG_MAX_LEVEL).
+#define Log(mode, moduleName, procedureName, ...)                                    \
+    do {                                                                             \
+        if ((mode) <= DORA_LOG_MAX_LEVEL && (mode) <= log_level)                     \
+            logRecord((mode), (moduleName), (procedureName), __VA_ARGS__);           \
+    } while (0)
 
 bool isFolder(string path);
 bool isFile(string path);
+bool createFolder(string path);
 int  fileSize(string filename);
 
 vector<string> listFiles(string folder);
-vector<string> loadImages(string filename);
 string getFileName(string path);
 string getFolderName(string path);
 string getCurrentFolder();
@@ -52,6 +71,8 @@ string getDiffString(int64 startTick);
 
 string getCurrentTimeStamp();
 
+uint64_t getHash(const void *data, size_t length, uint64_t seed = 0);
+
 bool isMatValid(Mat m);
 string getMatType(Mat m);
 
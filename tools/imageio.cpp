@@ -0,0 +1,420 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include "imageio.h"
+#include <opencv2/imgproc.hpp>
+
+#ifdef DORA_WITH_TIFF
+#include <tiffio.h>
+#endif
+
+#ifdef DORA_WITH_POPPLER
+#include <memory>
+#include <poppler/cpp/poppler-version.h>
+#include <poppler/cpp/poppler-document.h>
+#include <poppler/cpp/poppler-page.h>
+#include <poppler/cpp/poppler-page-renderer.h>
+#include <poppler/cpp/poppler-image.h>
+#endif
+
+#define IMAGE_HEADER_BYTES  65536   //JPEG frame headers come after the APPn segments (EXIF thumbnails included)
+#define PDF_DEFAULT_DPI     150     //used when no sample dimension is given
+#define PDF_POINTS_PER_INCH 72.0
+
+static int readBigEndian16(const uchar *p) { return (p[0] << 8) | p[1]; }
+static int readBigEndian32(const uchar *p) { return (int) (((unsigned) p[0] << 24) | ((unsigned) p[1] << 16) | ((unsigned) p[2] << 8) | p[3]); }
+static int readLittleEndian32(const uchar *p) { return (int) (((unsigned) p[3] << 24) | ((unsigned) p[2] << 16) | ((unsigned) p[1] << 8) | p[0]); }
+static int readLittleEndian16(const uchar *p) { return (p[1] << 8) | p[0]; }
+
+enumImageFormat getImageFormat(const uchar *data, size_t length){
+
+    if (length >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return image_JPEG;
+    if (length >= 8 && memcmp(data, "\x89PNG\r\n\x1A\n", 8) == 0)
+        return image_PNG;
+    if (length >= 2 && data[0] == 'B' && data[1] == 'M')
+        return image_BMP;
+    if (length >= 4 && (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0))
+        return image_TIFF;
+    if (length >= 5 && memcmp(data, "%PDF-", 5) == 0)
+        return image_PDF;
+
+    return image_UNKNOWN;
+}
+
+enumImageFormat getImageFormat(string filename){
+
+    uchar signature[8];
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL)
+        return image_UNKNOWN;
+    size_t length = fread(signature, 1, sizeof(signature), fp);
+    fclose(fp);
+
+    return getImageFormat(signature, length);
+}
+
+//Walks the JPEG segments up to the first SOFn marker, which holds the frame size
+static bool readJPEGSize(const uchar *data, size_t length, Size &size){
+
+    size_t pos = 2;
+
+    while (pos + 4 <= length) {
+
+        if (data[pos] != 0xFF)
+            return false;
+
+        uchar marker = data[pos + 1];
+
+        //fill bytes
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+
+        //standalone markers (TEM, RSTn)
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+
+        int segmentLength = readBigEndian16(data + pos + 2);
+
+        //SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > length)
+                return false;
+            size.height = readBigEndian16(data + pos + 5);
+            size.width = readBigEndian16(data + pos + 7);
+            return (size.width > 0 && size.height > 0);
+        }
+
+        //start of scan: no frame header was found
+        if (marker == 0xDA)
+            return false;
+
+        pos += 2 + segmentLength;
+    }
+
+    return false;
+}
+
+bool readImageHeader(const uchar *data, size_t length, enumImageFormat &format, Size &size){
+
+    format = getImageFormat(data, length);
+
+    switch (format) {
+        case image_JPEG:
+            return readJPEGSize(data, length, size);
+
+        case image_PNG:
+            //IHDR is always the first chunk
+            if (length < 24)
+                return false;
+            size.width = readBigEndian32(data + 16);
+            size.height = readBigEndian32(data + 20);
+            return (size.width > 0 && size.height > 0);
+
+        case image_BMP:
+            if (length < 26)
+                return false;
+            size.width = readLittleEndian32(data + 18);
+            size.height = abs(readLittleEndian32(data + 22));   //negative height means top-down rows
+            return (size.width > 0 && size.height > 0);
+
+        default:
+            return false;
+    }
+}
+
+bool readImageHeader(string filename, enumImageFormat &format, Size &size){
+
+    format = image_UNKNOWN;
+
+    try {
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (fp == NULL)
+            return false;
+
+        vector<uchar> buffer(IMAGE_HEADER_BYTES);
+        size_t length = fread(buffer.data(), 1, buffer.size(), fp);
+        fclose(fp);
+
+        return readImageHeader(buffer.data(), length, format, size);
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "imageio.cpp", "readImageHeader", "      Failed to read image header: %s", e.what());
+    }
+
+    return false;
+}
+
+int getReducedReadFlag(int factor, bool grayscale){
+
+    switch (factor) {
+        case 2:  return (grayscale ? IMREAD_REDUCED_GRAYSCALE_2 : IMREAD_REDUCED_COLOR_2);
+        case 4:  return (grayscale ? IMREAD_REDUCED_GRAYSCALE_4 : IMREAD_REDUCED_COLOR_4);
+        case 8:  return (grayscale ? IMREAD_REDUCED_GRAYSCALE_8 : IMREAD_REDUCED_COLOR_8);
+        default: return (grayscale ? IMREAD_GRAYSCALE : IMREAD_COLOR);
+    }
+}
+
+#ifdef DORA_WITH_TIFF
+static TIFF *openTIFF(string filename){
+
+    //libtiff reports unknown tags on stderr otherwise (scanners write plenty of them)
+    static bool handlersSet = false;
+    if (!handlersSet) {
+        TIFFSetWarningHandler(NULL);
+        handlersSet = true;
+    }
+
+    return TIFFOpen(filename.c_str(), "r");
+}
+
+//Every decode worker keeps its last TIFF open, the same way the PDF documents are kept below. A worker is handed
+//the pages of a file in increasing order, so the next one is a few TIFFReadDirectory calls away instead of a walk
+//of the directory chain from the first page (and a new open) for every page.
+struct OpenTIFF {
+    string  filename;
+    TIFF   *tif = NULL;
+
+    ~OpenTIFF() {
+        if (tif != NULL)
+            TIFFClose(tif);
+    }
+
+    void close() {
+        if (tif != NULL)
+            TIFFClose(tif);
+        tif = NULL;
+        filename = "";
+    }
+};
+
+static TIFF *openTIFFPage(string filename, int page){
+
+    static thread_local OpenTIFF handle;
+
+    if (handle.tif == NULL || handle.filename != filename) {
+        handle.close();
+        handle.tif = openTIFF(filename);
+        if (handle.tif == NULL)
+            return NULL;
+        handle.filename = filename;
+    }
+
+    int current = (int) TIFFCurrentDirectory(handle.tif);
+
+    //an earlier page (another worker took the ones in between, or the file is read again) walks from the start
+    if (page < current && !TIFFSetDirectory(handle.tif, (tdir_t) page)) {
+        handle.close();
+        return NULL;
+    }
+
+    for (; current < page; current++) {
+        if (!TIFFReadDirectory(handle.tif)) {
+            handle.close();
+            return NULL;
+        }
+    }
+
+    return handle.tif;
+}
+#endif
+
+#ifdef DORA_WITH_POPPLER
+//Every decode worker keeps its last document open, so the pages of one PDF do not parse the file again and again
+static poppler::document *openPDF(string filename){
+
+    static thread_local string openFilename;
+    static thread_local unique_ptr<poppler::document> document;
+
+    if (!document || openFilename != filename) {
+        document.reset(poppler::document::load_from_file(filename));
+        openFilename = filename;
+    }
+
+    return (document && !document->is_locked() ? document.get() : NULL);
+}
+
+//Renders a PDF page straight to a Mat, at the lowest resolution that still gives 'desiredDimension' pixels
+//on the short side of the page (or on the long side when 'fitLongSide' is set)
+static bool renderPDFPage(string filename, int page, bool grayscale, int desiredDimension, bool fitLongSide, Mat &output){
+
+    poppler::document *document = openPDF(filename);
+    if (document == NULL || page < 0 || page >= document->pages())
+        return false;
+
+    unique_ptr<poppler::page> pdfPage(document->create_page(page));
+    if (!pdfPage)
+        return false;
+
+    //page size in points (1/72 inch)
+    poppler::rectf rect = pdfPage->page_rect();
+    double side = (fitLongSide ? max(rect.width(), rect.height()) : min(rect.width(), rect.height()));
+
+    double dpi = PDF_DEFAULT_DPI;
+    if (desiredDimension > 0 && side > 0)
+        dpi = ceil(desiredDimension * PDF_POINTS_PER_INCH / side);
+
+    poppler::page_renderer renderer;
+    renderer.set_render_hints(poppler::page_renderer::antialiasing | poppler::page_renderer::text_antialiasing);
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 65
+    if (grayscale)
+        renderer.set_image_format(poppler::image::format_gray8);
+#endif
+
+    poppler::image image = renderer.render_page(pdfPage.get(), dpi, dpi);
+    if (!image.is_valid())
+        return false;
+
+    Log(log_Detail, "imageio.cpp", "renderPDFPage", "      Page %i rendered at %.0f dpi (W:%i x H:%i).", page + 1, dpi, image.width(), image.height());
+
+    //wraps poppler's buffer and copies it out while converting
+    switch (image.format()) {
+        case poppler::image::format_argb32: {
+            Mat bgra(image.height(), image.width(), CV_8UC4, (void *) image.const_data(), image.bytes_per_row());
+            cvtColor(bgra, output, (grayscale ? COLOR_BGRA2GRAY : COLOR_BGRA2BGR));
+            return true;
+        }
+        case poppler::image::format_rgb24: {
+            Mat rgb(image.height(), image.width(), CV_8UC3, (void *) image.const_data(), image.bytes_per_row());
+            cvtColor(rgb, output, (grayscale ? COLOR_RGB2GRAY : COLOR_RGB2BGR));
+            return true;
+        }
+#if POPPLER_VERSION_MAJOR > 0 || POPPLER_VERSION_MINOR >= 65
+        case poppler::image::format_gray8: {
+            Mat gray(image.height(), image.width(), CV_8UC1, (void *) image.const_data(), image.bytes_per_row());
+            if (grayscale)
+                gray.copyTo(output);
+            else
+                cvtColor(gray, output, COLOR_GRAY2BGR);
+            return true;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+#endif
+
+//Files that are always read through readPage(), even when they have a single page
+bool isPagedFormat(enumImageFormat format){
+    return (format == image_PDF);
+}
+
+#ifdef DORA_WITH_TIFF
+//Follows the directory chain of a classic TIFF in memory: the header points to the first directory, every
+//directory ends with the offset of the next one (0 on the last page)
+static int countTIFFDirectories(const uchar *data, size_t length){
+
+    if (length < 8)
+        return 0;
+
+    bool littleEndian = (data[0] == 'I');
+    size_t offset = (size_t) (unsigned) (littleEndian ? readLittleEndian32(data + 4) : readBigEndian32(data + 4));
+    int pages = 0;
+
+    //a directory takes at least 6 bytes, more of them than that means the chain loops
+    while (offset != 0 && offset + 2 <= length && (size_t) pages < length / 6) {
+        size_t entries = (size_t) (littleEndian ? readLittleEndian16(data + offset) : readBigEndian16(data + offset));
+        size_t next = offset + 2 + entries * 12;
+        if (next + 4 > length)
+            break;
+        pages++;
+        offset = (size_t) (unsigned) (littleEndian ? readLittleEndian32(data + next) : readBigEndian32(data + next));
+    }
+
+    return pages;
+}
+#endif
+
+//Number of pages in an encoded file: the directory count for TIFF files, the page count for PDF files, 1 for
+//every other image. Works on the bytes already read, so counting does not go back to the disk.
+int getPageCount(const uchar *data, size_t length){
+
+    try {
+        enumImageFormat format = getImageFormat(data, length);
+
+        if (format == image_PDF) {
+#ifdef DORA_WITH_POPPLER
+            unique_ptr<poppler::document> document(poppler::document::load_from_raw_data((const char *) data, (int) length));
+            return (document && !document->is_locked() ? document->pages() : 0);
+#else
+            Log(log_Error, "imageio.cpp", "getPageCount", "      Built without poppler, cannot read pdf files.");
+            return 0;
+#endif
+        }
+
+        if (format == image_TIFF) {
+#ifdef DORA_WITH_TIFF
+            return countTIFFDirectories(data, length);
+#else
+            Log(log_Detail, "imageio.cpp", "getPageCount", "      Built without libtiff, only the first page of tiff files will be read.");
+#endif
+        }
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "imageio.cpp", "getPageCount", "      Failed to count pages: %s", e.what());
+    }
+
+    return 1;
+}
+
+//Decodes a single page. Only that page is read from disk, so a long document never has to be expanded in memory.
+//'desiredDimension' and 'fitLongSide' size the rasterization of PDF pages, TIFF pages are read at their own size.
+bool readPage(string filename, int page, bool grayscale, int desiredDimension, bool fitLongSide, Mat &output){
+
+    try {
+        if (getImageFormat(filename) == image_PDF) {
+#ifdef DORA_WITH_POPPLER
+            if (renderPDFPage(filename, page, grayscale, desiredDimension, fitLongSide, output))
+                return true;
+            Log(log_Error, "imageio.cpp", "readPage", "      Failed to render page %i of '%s'.", page + 1, filename.c_str());
+#else
+            (void) desiredDimension;
+            (void) fitLongSide;
+            Log(log_Error, "imageio.cpp", "readPage", "      Built without poppler, cannot read '%s'.", filename.c_str());
+#endif
+            return false;
+        }
+
+#ifdef DORA_WITH_TIFF
+        TIFF *tif = openTIFFPage(filename, page);
+        if (tif == NULL) {
+            Log(log_Error, "imageio.cpp", "readPage", "      Failed to open page %i of '%s'.", page + 1, filename.c_str());
+            return false;
+        }
+
+        bool res = false;
+        uint32_t width = 0, height = 0;
+
+        if (TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width) &&
+            TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height)) {
+
+            //libtiff expands every photometric (bilevel fax pages included) to 8 bit RGBA
+            Mat rgba((int) height, (int) width, CV_8UC4);
+            if (TIFFReadRGBAImageOriented(tif, width, height, (uint32_t *) rgba.data, ORIENTATION_TOPLEFT, 0)) {
+                cvtColor(rgba, output, (grayscale ? COLOR_RGBA2GRAY : COLOR_RGBA2BGR));
+                res = true;
+            }
+        }
+
+        if (!res)
+            Log(log_Error, "imageio.cpp", "readPage", "      Failed to read page %i of '%s'.", page + 1, filename.c_str());
+        return res;
+#else
+        if (page == 0) {
+            output = imread(filename, (grayscale ? IMREAD_GRAYSCALE : IMREAD_COLOR));
+            return !output.empty();
+        }
+        Log(log_Error, "imageio.cpp", "readPage", "      Built without libtiff, cannot read page %i of '%s'.", page + 1, filename.c_str());
+#endif
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "imageio.cpp", "readPage", "      Failed to read page: %s", e.what());
+    }
+
+    return false;
+}
@@ -0,0 +1,43 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Image file helpers that work below imread(): reading the image dimensions
+// straight from the file header (JPEG, PNG and BMP) without decoding any
+// pixel, choosing the reduced imread flags for a given scale factor and
+// reading multi-page files one page at a time: TIFF through libtiff (when
+// dora is built with DORA_WITH_TIFF) and PDF rasterized by poppler (when
+// built with DORA_WITH_POPPLER).
+//
+
+#ifndef DORA_IMAGEIO_H
+#define DORA_IMAGEIO_H
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "helper.h"
+
+using namespace cv;
+using namespace std;
+
+enum enumImageFormat
+{
+    image_UNKNOWN = 0,
+    image_JPEG = 1,
+    image_PNG = 2,
+    image_BMP = 3,
+    image_TIFF = 4,
+    image_PDF = 5,
+};
+
+enumImageFormat getImageFormat(const uchar *data, size_t length);
+enumImageFormat getImageFormat(string filename);
+bool readImageHeader(const uchar *data, size_t length, enumImageFormat &format, Size &size);
+bool readImageHeader(string filename, enumImageFormat &format, Size &size);
+
+int  getReducedReadFlag(int factor, bool grayscale);
+
+int  getPageCount(const uchar *data, size_t length);
+bool isPagedFormat(enumImageFormat format);
+bool readPage(string filename, int page, bool grayscale, int desiredDimension, bool fitLongSide, Mat &output);
+
+#endif
@@ -0,0 +1,246 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// The ring is a bounded MPSC queue (Dmitry Vyukov's sequence-per-slot design).
+// Each slot carries a sequence number: a producer owns slot 'pos' when its
+// sequence equals 'pos', and publishes it by storing 'pos + 1'. The flush
+// thread consumes it and hands it back by storing 'pos + LOG_RING_SIZE'.
+//
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <ctime>
+#include "logger.h"
+
+#define LOG_RING_SIZE     4096      //must be a power of two
+#define LOG_RECORD_SIZE   512       //bytes per formatted line (longer lines are truncated)
+#define LOG_IDLE_WAIT_MS  20        //how long the flush thread sleeps when the ring is empty
+
+struct LogSlot {
+    atomic<size_t>  sequence;
+    time_t          timestamp;
+    int             length;
+    char            text[LOG_RECORD_SIZE];
+};
+
+static LogSlot              log_ring[LOG_RING_SIZE];
+static atomic<size_t>       log_enqueuePos(0);
+static size_t               log_dequeuePos = 0;
+static atomic<size_t>       log_flushedPos(0);
+static atomic<long>         log_dropCount(0);
+static atomic<int>          log_overflow(logOverflow_DROP);
+static atomic<bool>         log_running(false);
+static atomic<bool>         log_stopped(false);
+static atomic<bool>         log_stopping(false);
+static atomic<int>          log_producers(0);       //pushLogRecord calls between their running check and their publish
+static thread               log_thread;
+static FILE *               log_file = NULL;
+static string               log_filename = "log.txt";
+static mutex                log_controlMutex;
+
+static void initializeRing(){
+    for (size_t i = 0; i < LOG_RING_SIZE; i++)
+        log_ring[i].sequence.store(i, memory_order_relaxed);
+    log_enqueuePos.store(0, memory_order_relaxed);
+    log_dequeuePos = 0;
+    log_flushedPos.store(0, memory_order_release);
+}
+
+//Writes every published slot. Only called from the flush thread (or from stopLogger after it was joined).
+static size_t drainRing(){
+
+    size_t count = 0;
+
+    while (true) {
+        LogSlot &slot = log_ring[log_dequeuePos & (LOG_RING_SIZE - 1)];
+        size_t seq = slot.sequence.load(memory_order_acquire);
+
+        if (seq != log_dequeuePos + 1)
+            break;
+
+        //Console gets the bare line, the file gets it prefixed with the timestamp
+        fwrite(slot.text, 1, (size_t) slot.length, stdout);
+
+        if (log_file != NULL) {
+            char stamp[24];
+            struct tm sTm;
+            gmtime_r(&slot.timestamp, &sTm);
+            size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S | ", &sTm);
+            fwrite(stamp, 1, n, log_file);
+            fwrite(slot.text, 1, (size_t) slot.length, log_file);
+        }
+
+        slot.sequence.store(log_dequeuePos + LOG_RING_SIZE, memory_order_release);
+        log_dequeuePos++;
+        count++;
+    }
+
+    if (count > 0) {
+        fflush(stdout);
+        if (log_file != NULL)
+            fflush(log_file);
+        log_flushedPos.store(log_dequeuePos, memory_order_release);
+    }
+
+    return count;
+}
+
+static void flushThread(){
+
+    while (!log_stopping.load(memory_order_acquire)) {
+        if (drainRing() == 0)
+            this_thread::sleep_for(chrono::milliseconds(LOG_IDLE_WAIT_MS));
+    }
+
+    drainRing();
+}
+
+bool startLogger(string filename){
+
+    lock_guard<mutex> lock(log_controlMutex);
+
+    if (log_running.load(memory_order_acquire))
+        return true;
+
+    initializeRing();
+
+    log_filename = filename;
+    log_file = fopen(log_filename.c_str(), "a+");
+    log_stopped.store(false, memory_order_release);
+    log_stopping.store(false, memory_order_release);
+    log_thread = thread(flushThread);
+    log_running.store(true, memory_order_release);
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(stopLogger);
+        registered = true;
+    }
+
+    return (log_file != NULL);
+}
+
+void stopLogger(){
+
+    lock_guard<mutex> lock(log_controlMutex);
+
+    if (!log_running.load(memory_order_acquire))
+        return;
+
+    //New records are written directly from now on. The ones already claiming a slot are waited for while the
+    //flush thread still drains the ring (a producer may be waiting for room), so its last drain gets them all.
+    log_stopped.store(true);
+    log_running.store(false);
+    while (log_producers.load() > 0)
+        this_thread::yield();
+
+    log_stopping.store(true, memory_order_release);
+    if (log_thread.joinable())
+        log_thread.join();
+
+    if (log_dropCount.load() > 0 && log_file != NULL)
+        fprintf(log_file, "logger: %ld records were dropped because the ring buffer was full.\n", log_dropCount.load());
+
+    if (log_file != NULL) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+void flushLogger(){
+
+    if (!log_running.load(memory_order_acquire))
+        return;
+
+    //Waits until the flush thread has written everything claimed so far
+    size_t target = log_enqueuePos.load(memory_order_acquire);
+    while (log_flushedPos.load(memory_order_acquire) < target && log_running.load(memory_order_acquire))
+        this_thread::sleep_for(chrono::milliseconds(1));
+}
+
+void setLogOverflow(logOverflow policy){
+    log_overflow.store(policy, memory_order_relaxed);
+}
+
+long getLogDropCount(){
+    return log_dropCount.load(memory_order_relaxed);
+}
+
+//Formats a line as 'module (18 chars) | procedure (22 chars) | information\n' and returns its length
+static int formatRecord(char *buffer, const char *moduleName, const char *procedureName, const char *information, va_list args){
+
+    int n = snprintf(buffer, LOG_RECORD_SIZE, "%-18.18s | %-22.22s | ", moduleName, procedureName);
+    int m = vsnprintf(buffer + n, (size_t) (LOG_RECORD_SIZE - n), information, args);
+    if (m < 0)
+        m = 0;
+    n = (n + m > LOG_RECORD_SIZE - 2 ? LOG_RECORD_SIZE - 2 : n + m);
+    buffer[n++] = '\n';
+    buffer[n] = '\0';
+    return n;
+}
+
+//Used for the few records logged after stopLogger() (e.g. from other atexit handlers)
+static void writeRecordDirectly(const char *moduleName, const char *procedureName, const char *information, va_list args){
+
+    char text[LOG_RECORD_SIZE];
+    int length = formatRecord(text, moduleName, procedureName, information, args);
+
+    fwrite(text, 1, (size_t) length, stdout);
+
+    FILE *fp = fopen(log_filename.c_str(), "a+");
+    if (fp != NULL) {
+        fprintf(fp, "%s | %s", getCurrentTimeStamp().c_str(), text);
+        fclose(fp);
+    }
+}
+
+void pushLogRecord(logMode mode, const char *moduleName, const char *procedureName, const char *information, va_list args){
+
+    if (!log_running.load(memory_order_acquire) && !log_stopped.load(memory_order_acquire))
+        startLogger(log_filename);
+
+    //Announced before the running check (both sequentially consistent), so stopLogger either sees this
+    //producer or this producer sees the logger stopped
+    log_producers.fetch_add(1);
+    if (!log_running.load()) {
+        log_producers.fetch_sub(1);
+        writeRecordDirectly(moduleName, procedureName, information, args);
+        return;
+    }
+
+    LogSlot *slot;
+    size_t pos = log_enqueuePos.load(memory_order_relaxed);
+
+    //Claims a slot
+    while (true) {
+        slot = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = slot->sequence.load(memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (log_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            //Ring is full. Errors are rare enough to always wait, anything else follows the overflow policy
+            if (mode != log_Error && log_overflow.load(memory_order_relaxed) == logOverflow_DROP) {
+                log_dropCount.fetch_add(1, memory_order_relaxed);
+                log_producers.fetch_sub(1, memory_order_release);
+                return;
+            }
+            this_thread::yield();
+            pos = log_enqueuePos.load(memory_order_relaxed);
+        } else {
+            pos = log_enqueuePos.load(memory_order_relaxed);
+        }
+    }
+
+    //Formats the line straight into the slot
+    slot->timestamp = time(0);
+    slot->length = formatRecord(slot->text, moduleName, procedureName, information, args);
+
+    //Publishes it to the flush thread
+    slot->sequence.store(pos + 1, memory_order_release);
+    log_producers.fetch_sub(1, memory_order_release);
+}
@@ -0,0 +1,34 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Background logger behind Log(). Producers claim a slot on a lock-free
+// multi-producer/single-consumer ring buffer, format their message straight
+// into it and return. A dedicated thread drains the ring, prints to the
+// console and appends to a log file that stays open for the whole run.
+//
+
+#ifndef DORA_LOGGER_H
+#define DORA_LOGGER_H
+
+#include <cstdarg>
+#include <string>
+#include "helper.h"
+
+using namespace std;
+
+enum logOverflow
+{
+    logOverflow_DROP = 0,   //when the ring is full the record is dropped (and counted). Never blocks the caller.
+    logOverflow_BLOCK = 1,  //when the ring is full the caller yields until the flush thread frees a slot.
+};
+
+bool startLogger(string filename);
+void stopLogger();
+void flushLogger();
+
+void setLogOverflow(logOverflow policy);
+long getLogDropCount();
+
+void pushLogRecord(logMode mode, const char *moduleName, const char *procedureName, const char *information, va_list args);
+
+#endif
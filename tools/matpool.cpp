@@ -0,0 +1,161 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <atomic>
+#include "opencv2/core/types_c.h"
+#include "matpool.h"
+#include "metrics.h"
+
+#define MATPOOL_MIN_BITS        11                      //the smallest class holds 4KB (last quarter of 2^11..2^12)
+#define MATPOOL_MIN_BYTES       (1 << 12)               //smaller mats are not worth pooling
+#define MATPOOL_MAX_BYTES       ((size_t) 1 << 28)
+#define MATPOOL_CLASS_COUNT     ((28 - MATPOOL_MIN_BITS) * 4)
+#define MATPOOL_CLASS_DEPTH     4                       //idle buffers kept per class
+#define MATPOOL_THREAD_BYTES    ((size_t) 128 << 20)    //idle bytes kept per thread
+
+struct MatPoolBuckets {
+    vector<uchar *>     buffers[MATPOOL_CLASS_COUNT];
+    size_t              bytes;
+
+    MatPoolBuckets() : bytes(0) {}
+};
+
+//The buckets are reached through plain thread locals, which stay valid while the thread exits: a mat
+//freed after the guard has run finds no buckets and goes straight back to the heap
+static thread_local MatPoolBuckets  *pool_buckets = NULL;
+static thread_local bool            pool_exited = false;
+static atomic<bool>                 pool_enabled(true);
+
+static void freeBuckets(MatPoolBuckets *buckets) {
+
+    for (int c = 0; c < MATPOOL_CLASS_COUNT; c++)
+        for (size_t i = 0; i < buckets->buffers[c].size(); i++)
+            fastFree(buckets->buffers[c][i]);
+}
+
+//Frees the buckets when the thread exits
+struct MatPoolGuard {
+    void attach(MatPoolBuckets *buckets) {
+        pool_buckets = buckets;
+    }
+
+    ~MatPoolGuard() {
+        if (pool_buckets != NULL) {
+            freeBuckets(pool_buckets);
+            delete pool_buckets;
+            pool_buckets = NULL;
+        }
+        pool_exited = true;
+    }
+};
+
+static thread_local MatPoolGuard    pool_guard;
+
+static MatPoolBuckets *getBuckets() {
+
+    if (pool_buckets == NULL && !pool_exited)
+        pool_guard.attach(new MatPoolBuckets());
+    return pool_buckets;
+}
+
+//Size class of a buffer and the bytes every buffer of the class has, -1 if it is not pooled
+static int getSizeClass(size_t size, size_t &capacity) {
+
+    if (size < MATPOOL_MIN_BYTES || size > MATPOOL_MAX_BYTES)
+        return -1;
+
+    int k = 63 - __builtin_clzll((uint64_t) size - 1);      //2^k < size <= 2^(k + 1)
+    uint64_t quarter = (uint64_t) 1 << (k - 2);
+    uint64_t j = ((uint64_t) size - 1 - ((uint64_t) 1 << k)) / quarter;
+
+    capacity = (size_t) (((uint64_t) 1 << k) + (j + 1) * quarter);
+    return (k - MATPOOL_MIN_BITS) * 4 + (int) j;
+}
+
+//Same layout as the default allocator, only the buffer may come from the pool
+UMatData *PooledMatAllocator::allocate(int dims, const int *sizes, int type, void *data0, size_t *step, int flags, UMatUsageFlags usageFlags) const {
+
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                CV_Assert(total <= step[i]);
+                total = step[i];
+            } else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    uchar *data = (uchar *) data0;
+    if (data == NULL) {
+        size_t capacity = 0;
+        int sizeClass = getSizeClass(total, capacity);
+        MatPoolBuckets *buckets = (sizeClass >= 0 ? getBuckets() : NULL);
+
+        if (buckets != NULL && !buckets->buffers[sizeClass].empty()) {
+            data = buckets->buffers[sizeClass].back();
+            buckets->buffers[sizeClass].pop_back();
+            buckets->bytes -= capacity;
+            incrementCounter(counter_MAT_POOL_HITS);
+        } else {
+            data = (uchar *) fastMalloc(sizeClass >= 0 ? capacity : total);
+            if (sizeClass >= 0)
+                incrementCounter(counter_MAT_POOL_MISSES);
+        }
+    }
+
+    UMatData *u = new UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    u->userdata = pool_buckets;     //only compared on release, never followed
+    if (data0)
+        u->flags |= UMatData::USER_ALLOCATED;
+
+    return u;
+}
+
+bool PooledMatAllocator::allocate(UMatData *u, int accessFlags, UMatUsageFlags usageFlags) const {
+    return (u != NULL);
+}
+
+void PooledMatAllocator::deallocate(UMatData *u) const {
+
+    if (u == NULL)
+        return;
+
+    CV_Assert(u->urefcount == 0 && u->refcount == 0);
+
+    if (!(u->flags & UMatData::USER_ALLOCATED)) {
+        size_t capacity = 0;
+        int sizeClass = getSizeClass(u->size, capacity);
+        MatPoolBuckets *buckets = (sizeClass >= 0 && u->userdata == pool_buckets ? pool_buckets : NULL);
+
+        if (buckets != NULL && buckets->buffers[sizeClass].size() < MATPOOL_CLASS_DEPTH &&
+            buckets->bytes + capacity <= MATPOOL_THREAD_BYTES) {
+            buckets->buffers[sizeClass].push_back(u->origdata);
+            buckets->bytes += capacity;
+        } else
+            fastFree(u->origdata);
+
+        u->origdata = 0;
+    }
+
+    delete u;
+}
+
+//Mats allocated by the pool can outlive any static object, so the allocator is never destroyed
+MatAllocator *getPooledMatAllocator() {
+    static PooledMatAllocator *allocator = new PooledMatAllocator();
+    return allocator;
+}
+
+//Drops the mat and makes its next create() take a buffer from the pool (or from the heap if the pool is off)
+void preparePooledMat(Mat &m) {
+    m.release();
+    m.allocator = (pool_enabled.load(memory_order_relaxed) ? getPooledMatAllocator() : NULL);
+}
+
+void setMatPool(bool enabled) {
+    pool_enabled.store(enabled, memory_order_relaxed);
+}
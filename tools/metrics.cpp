@@ -0,0 +1,267 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <atomic>
+#include <csignal>
+#include <cmath>
+#include "metrics.h"
+
+//Bucket layout: values below 64ns have one bucket each. Above that, every power
+//of two [2^k, 2^(k+1)) is split in 32 equal sub-buckets, up to 2^48ns (~78 hours).
+#define METRIC_SUB_BITS      6
+#define METRIC_SUB_COUNT     (1 << METRIC_SUB_BITS)
+#define METRIC_HALF_COUNT    (METRIC_SUB_COUNT / 2)
+#define METRIC_MAX_BITS      48
+#define METRIC_BUCKET_COUNT  (METRIC_SUB_COUNT + (METRIC_MAX_BITS - METRIC_SUB_BITS) * METRIC_HALF_COUNT)
+
+struct Histogram {
+    atomic<uint64_t> buckets[METRIC_BUCKET_COUNT];
+    atomic<uint64_t> count;
+    atomic<uint64_t> sum;
+    atomic<uint64_t> max;
+};
+
+static Histogram            metric_histograms[metric_COUNT];
+static atomic<long>         metric_counters[counter_COUNT];
+static atomic<bool>         metric_dumpRequested(false);
+static string               metric_dumpFilename;
+static enumMetricsFormat    metric_dumpFormat = metrics_JSON;
+
+static int bucketIndex(uint64_t v){
+
+    if (v < METRIC_SUB_COUNT)
+        return (int) v;
+
+    int msb = 63 - __builtin_clzll(v);
+    if (msb >= METRIC_MAX_BITS)
+        return METRIC_BUCKET_COUNT - 1;
+
+    int shift = msb - METRIC_SUB_BITS + 1;
+    int top = (int) (v >> shift);   //always in [32, 64)
+
+    return METRIC_SUB_COUNT + (shift - 1) * METRIC_HALF_COUNT + (top - METRIC_HALF_COUNT);
+}
+
+//Middle of the range of values that fall in a bucket
+static double bucketValue(int index){
+
+    if (index < METRIC_SUB_COUNT)
+        return index;
+
+    int shift = (index - METRIC_SUB_COUNT) / METRIC_HALF_COUNT + 1;
+    uint64_t top = (uint64_t) ((index - METRIC_SUB_COUNT) % METRIC_HALF_COUNT + METRIC_HALF_COUNT);
+    uint64_t low = top << shift;
+    uint64_t width = ((uint64_t) 1) << shift;
+
+    return (double) low + (double) (width - 1) / 2;
+}
+
+void recordLatency(enumMetric metric, int64 nanoseconds){
+
+    Histogram &h = metric_histograms[metric];
+    uint64_t v = (nanoseconds > 0 ? (uint64_t) nanoseconds : 0);
+
+    h.buckets[bucketIndex(v)].fetch_add(1, memory_order_relaxed);
+    h.count.fetch_add(1, memory_order_relaxed);
+    h.sum.fetch_add(v, memory_order_relaxed);
+
+    uint64_t current = h.max.load(memory_order_relaxed);
+    while (v > current && !h.max.compare_exchange_weak(current, v, memory_order_relaxed));
+}
+
+void incrementCounter(enumCounter counter, long value){
+    metric_counters[counter].fetch_add(value, memory_order_relaxed);
+}
+
+long getCounter(enumCounter counter){
+    return metric_counters[counter].load(memory_order_relaxed);
+}
+
+long getLatencyCount(enumMetric metric){
+    return (long) metric_histograms[metric].count.load(memory_order_relaxed);
+}
+
+double getLatencyPercentile(enumMetric metric, double percentile){
+
+    Histogram &h = metric_histograms[metric];
+    uint64_t total = h.count.load(memory_order_relaxed);
+
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t) ceil(percentile / 100.0 * total);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < METRIC_BUCKET_COUNT; i++) {
+        seen += h.buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            //The last bucket can not report more than what was actually seen
+            double value = bucketValue(i);
+            double max = (double) h.max.load(memory_order_relaxed);
+            return (value > max ? max : value) / 1e6;
+        }
+    }
+
+    return (double) h.max.load(memory_order_relaxed) / 1e6;
+}
+
+void resetMetrics(){
+
+    for (int m = 0; m < metric_COUNT; m++) {
+        for (int i = 0; i < METRIC_BUCKET_COUNT; i++)
+            metric_histograms[m].buckets[i].store(0, memory_order_relaxed);
+        metric_histograms[m].count.store(0, memory_order_relaxed);
+        metric_histograms[m].sum.store(0, memory_order_relaxed);
+        metric_histograms[m].max.store(0, memory_order_relaxed);
+    }
+
+    for (int c = 0; c < counter_COUNT; c++)
+        metric_counters[c].store(0, memory_order_relaxed);
+}
+
+string getMetricName(enumMetric metric){
+    switch (metric){
+        case metric_IMREAD:         return "imread";
+        case metric_WORK_MAT:       return "work_mat";
+        case metric_GRAYSCALE_MAT:  return "grayscale_mat";
+        case metric_BINARIZE:       return "binarize";
+        case metric_XYCUT:          return "xycut";
+        case metric_DETECT:         return "detect";
+        case metric_DESCRIPTORS:    return "descriptors";
+        case metric_BOW:            return "bow";
+        case metric_PREDICT:        return "predict";
+        case metric_FILE_READ:      return "file_read";
+        case metric_PROJECTION:     return "projection";
+        default:                    return "unknown";
+    }
+}
+
+string getCounterName(enumCounter counter){
+    switch (counter){
+        case counter_SAMPLES_LOADED:        return "samples_loaded";
+        case counter_LOAD_FAILURES:         return "load_failures";
+        case counter_SAMPLES_PREPROCESSED:  return "samples_preprocessed";
+        case counter_PREPROCESS_FAILURES:   return "preprocess_failures";
+        case counter_PREDICTIONS:           return "predictions";
+        case counter_ARTIFACTS_WRITTEN:     return "artifacts_written";
+        case counter_ARTIFACTS_DROPPED:     return "artifacts_dropped";
+        case counter_FRAMES_REUSED:         return "frames_reused";
+        case counter_MAT_POOL_HITS:         return "mat_pool_hits";
+        case counter_MAT_POOL_MISSES:       return "mat_pool_misses";
+        default:                            return "unknown";
+    }
+}
+
+static string formatDouble(double value){
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.6f", value);
+    return buffer;
+}
+
+static double getLatencyMean(enumMetric metric){
+    Histogram &h = metric_histograms[metric];
+    uint64_t count = h.count.load(memory_order_relaxed);
+    return (count > 0 ? (double) h.sum.load(memory_order_relaxed) / count / 1e6 : 0);
+}
+
+string formatMetrics(enumMetricsFormat format){
+
+    string res;
+
+    if (format == metrics_PROMETHEUS) {
+
+        for (int c = 0; c < counter_COUNT; c++) {
+            string name = "dora_" + getCounterName((enumCounter) c) + "_total";
+            res += "# TYPE " + name + " counter\n";
+            res += name + " " + to_string(getCounter((enumCounter) c)) + "\n";
+        }
+
+        res += "# HELP dora_stage_latency_seconds Latency of each pipeline stage.\n";
+        res += "# TYPE dora_stage_latency_seconds summary\n";
+        const double quantiles[] = {50, 90, 99, 99.9};
+        for (int m = 0; m < metric_COUNT; m++) {
+            enumMetric metric = (enumMetric) m;
+            string label = "stage=\"" + getMetricName(metric) + "\"";
+            for (double q : quantiles)
+                res += "dora_stage_latency_seconds{" + label + ",quantile=\"" + formatDouble(q / 100).substr(0, 5) + "\"} " + formatDouble(getLatencyPercentile(metric, q) / 1000) + "\n";
+            res += "dora_stage_latency_seconds_sum{" + label + "} " + formatDouble((double) metric_histograms[m].sum.load(memory_order_relaxed) / 1e9) + "\n";
+            res += "dora_stage_latency_seconds_count{" + label + "} " + to_string(getLatencyCount(metric)) + "\n";
+        }
+
+    } else {
+
+        res += "{\n  \"counters\": {";
+        for (int c = 0; c < counter_COUNT; c++)
+            res += string(c > 0 ? "," : "") + "\n    \"" + getCounterName((enumCounter) c) + "\": " + to_string(getCounter((enumCounter) c));
+        res += "\n  },\n  \"latency_ms\": {";
+        for (int m = 0; m < metric_COUNT; m++) {
+            enumMetric metric = (enumMetric) m;
+            res += string(m > 0 ? "," : "") + "\n    \"" + getMetricName(metric) + "\": {";
+            res += "\"count\": " + to_string(getLatencyCount(metric));
+            res += ", \"mean\": " + formatDouble(getLatencyMean(metric));
+            res += ", \"p50\": " + formatDouble(getLatencyPercentile(metric, 50));
+            res += ", \"p90\": " + formatDouble(getLatencyPercentile(metric, 90));
+            res += ", \"p99\": " + formatDouble(getLatencyPercentile(metric, 99));
+            res += ", \"max\": " + formatDouble((double) metric_histograms[m].max.load(memory_order_relaxed) / 1e6);
+            res += "}";
+        }
+        res += "\n  }\n}\n";
+    }
+
+    return res;
+}
+
+bool dumpMetrics(string filename, enumMetricsFormat format){
+
+    try {
+        Log(log_Debug, "metrics.cpp", "dumpMetrics", "   Writing metrics to '%s'...", filename.c_str());
+
+        FILE *fp = fopen(filename.c_str(), "w");
+        if (fp != NULL) {
+            string text = formatMetrics(format);
+            fwrite(text.c_str(), 1, text.size(), fp);
+            fclose(fp);
+            Log(log_Debug, "metrics.cpp", "dumpMetrics", "      Done.");
+            return true;
+        }
+
+        Log(log_Error, "metrics.cpp", "dumpMetrics", "      Failed to open metrics file '%s'.", filename.c_str());
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "metrics.cpp", "dumpMetrics", "      Failed to write metrics: %s", e.what());
+    }
+
+    return false;
+}
+
+void logMetrics(){
+
+    Log(log_Debug, "metrics.cpp", "logMetrics", "   Stage latencies (ms):");
+    for (int m = 0; m < metric_COUNT; m++) {
+        enumMetric metric = (enumMetric) m;
+        if (getLatencyCount(metric) > 0)
+            Log(log_Debug, "metrics.cpp", "logMetrics", "      %-14s count:%7li  mean:%9.3f  p50:%9.3f  p99:%9.3f", getMetricName(metric).c_str(), getLatencyCount(metric), getLatencyMean(metric), getLatencyPercentile(metric, 50), getLatencyPercentile(metric, 99));
+    }
+
+    long hits = getCounter(counter_MAT_POOL_HITS);
+    long misses = getCounter(counter_MAT_POOL_MISSES);
+    if (hits + misses > 0)
+        Log(log_Debug, "metrics.cpp", "logMetrics", "   Mat pool: %li allocations avoided, %li made (%.1f%% hit rate).", hits, misses, 100.0 * hits / (hits + misses));
+}
+
+static void onMetricsSignal(int){
+    metric_dumpRequested.store(true, memory_order_relaxed);
+}
+
+void enableMetricsDump(string filename, enumMetricsFormat format){
+    metric_dumpFilename = filename;
+    metric_dumpFormat = format;
+    signal(SIGUSR1, onMetricsSignal);
+}
+
+void pollMetricsDump(){
+    if (metric_dumpRequested.load(memory_order_relaxed) && metric_dumpRequested.exchange(false))
+        dumpMetrics(metric_dumpFilename, metric_dumpFormat);
+}
@@ -0,0 +1,85 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Process wide metrics registry: lock-free event counters and one latency
+// histogram per pipeline stage. Histograms use HDR-style log-linear buckets
+// (32 sub-buckets per power of two, about 3% worst case error) so p50/p99 can
+// be read back over any number of samples with a fixed amount of memory.
+//
+
+#ifndef DORA_METRICS_H
+#define DORA_METRICS_H
+
+#include <string>
+#include <chrono>
+#include "helper.h"
+
+using namespace std;
+
+enum enumMetric
+{
+    metric_IMREAD = 0,
+    metric_WORK_MAT = 1,
+    metric_GRAYSCALE_MAT = 2,
+    metric_BINARIZE = 3,
+    metric_XYCUT = 4,
+    metric_DETECT = 5,
+    metric_DESCRIPTORS = 6,
+    metric_BOW = 7,
+    metric_PREDICT = 8,
+    metric_FILE_READ = 9,
+    metric_PROJECTION = 10,
+    metric_COUNT = 11,   //number of metrics, keep it last
+};
+
+enum enumCounter
+{
+    counter_SAMPLES_LOADED = 0,
+    counter_LOAD_FAILURES = 1,
+    counter_SAMPLES_PREPROCESSED = 2,
+    counter_PREPROCESS_FAILURES = 3,
+    counter_PREDICTIONS = 4,
+    counter_ARTIFACTS_WRITTEN = 5,
+    counter_ARTIFACTS_DROPPED = 6,
+    counter_FRAMES_REUSED = 7,
+    counter_MAT_POOL_HITS = 8,
+    counter_MAT_POOL_MISSES = 9,
+    counter_COUNT = 10, //number of counters, keep it last
+};
+
+enum enumMetricsFormat
+{
+    metrics_JSON = 0,
+    metrics_PROMETHEUS = 1,
+};
+
+void   recordLatency(enumMetric metric, int64 nanoseconds);
+void   incrementCounter(enumCounter counter, long value = 1);
+long   getCounter(enumCounter counter);
+long   getLatencyCount(enumMetric metric);
+double getLatencyPercentile(enumMetric metric, double percentile);  //in milliseconds
+void   resetMetrics();
+
+string getMetricName(enumMetric metric);
+string getCounterName(enumCounter counter);
+
+string formatMetrics(enumMetricsFormat format);
+bool   dumpMetrics(string filename, enumMetricsFormat format);
+void   logMetrics();
+
+//On demand dumps: SIGUSR1 flags a request that the pipeline loops pick up on their next pollMetricsDump()
+void   enableMetricsDump(string filename, enumMetricsFormat format);
+void   pollMetricsDump();
+
+//Records the lifetime of the scope into a stage histogram
+class MetricTimer {
+    enumMetric                              mMetric;
+    chrono::steady_clock::time_point        mStart;
+public:
+    explicit MetricTimer(enumMetric metric) : mMetric(metric), mStart(chrono::steady_clock::now()) {}
+    ~MetricTimer() {
+        recordLatency(mMetric, (int64) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - mStart).count());
+    }
+};
+
+#endif
@@ -0,0 +1,90 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Bounded blocking queue shared by the producer/consumer stages (sample
+// loader, background writers). push() waits while the queue is full,
+// tryPush() gives up instead, pop() waits for an item and returns false
+// once the queue was closed and drained, tryPop() only takes what is there.
+//
+
+#ifndef DORA_QUEUE_H
+#define DORA_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+template <typename T>
+class BoundedQueue {
+    deque<T>            mItems;
+    size_t              mCapacity;
+    bool                mClosed = false;
+    mutex               mMutex;
+    condition_variable  mNotEmpty;
+    condition_variable  mNotFull;
+
+public:
+    explicit BoundedQueue(size_t capacity) : mCapacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item) {
+        unique_lock<mutex> lock(mMutex);
+        mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+        if (mClosed)
+            return false;
+        mItems.push_back(std::move(item));
+        lock.unlock();
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    bool tryPush(T item) {
+        unique_lock<mutex> lock(mMutex);
+        if (mClosed || mItems.size() >= mCapacity)
+            return false;
+        mItems.push_back(std::move(item));
+        lock.unlock();
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        unique_lock<mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+        if (mItems.empty())
+            return false;
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        lock.unlock();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    bool tryPop(T &item) {
+        unique_lock<mutex> lock(mMutex);
+        if (mItems.empty())
+            return false;
+        item = std::move(mItems.front());
+        mItems.pop_front();
+        lock.unlock();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> lock(mMutex);
+            mClosed = true;
+        }
+        mNotEmpty.notify_all();
+        mNotFull.notify_all();
+    }
+
+    size_t size() {
+        lock_guard<mutex> lock(mMutex);
+        return mItems.size();
+    }
+};
+
+#endif
@@ -0,0 +1,159 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <sys/syscall.h>
+#include "trace.h"
+
+struct TraceEvent {
+    const char *    name;
+    string          detail;
+    int64           start;
+    int64           end;
+};
+
+struct TraceBuffer {
+    long                tid;
+    string              threadName;
+    vector<TraceEvent>  events;
+};
+
+atomic<bool>                trace_enabled(false);
+static string               trace_filename;
+static int64                trace_origin = 0;
+static mutex                trace_mutex;
+static vector<TraceBuffer*> trace_buffers;
+
+//Each thread appends to its own buffer, the mutex is only taken to register it
+static TraceBuffer * getThreadBuffer(){
+
+    static thread_local TraceBuffer *buffer = NULL;
+
+    if (buffer == NULL) {
+        buffer = new TraceBuffer();
+        buffer->tid = (long) syscall(SYS_gettid);
+        buffer->events.reserve(4096);
+
+        lock_guard<mutex> lock(trace_mutex);
+        trace_buffers.push_back(buffer);
+    }
+
+    return buffer;
+}
+
+int64 getTraceClock(){
+    return (int64) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static string escapeJson(const string &input){
+
+    string res;
+    res.reserve(input.size());
+
+    for (char c : input) {
+        switch (c) {
+            case '"':  res += "\\\""; break;
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n";  break;
+            case '\t': res += "\\t";  break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    res += buffer;
+                } else
+                    res += c;
+        }
+    }
+
+    return res;
+}
+
+bool startTrace(string filename){
+
+    lock_guard<mutex> lock(trace_mutex);
+
+    trace_filename = filename;
+    trace_origin = getTraceClock();
+    trace_enabled.store(true, memory_order_release);
+
+    Log(log_Debug, "trace.cpp", "startTrace", "Tracing to '%s'.", filename.c_str());
+    return true;
+}
+
+void setTraceThreadName(string name){
+    if (trace_enabled.load(memory_order_relaxed))
+        getThreadBuffer()->threadName = name;
+}
+
+void addTraceEvent(const char *name, const string &detail, int64 startNanoseconds, int64 endNanoseconds){
+
+    TraceEvent e;
+    e.name = name;
+    e.detail = detail;
+    e.start = startNanoseconds;
+    e.end = endNanoseconds;
+
+    getThreadBuffer()->events.push_back(e);
+}
+
+bool stopTrace(){
+
+    if (!trace_enabled.load(memory_order_acquire))
+        return false;
+
+    trace_enabled.store(false, memory_order_release);
+
+    try {
+        Log(log_Debug, "trace.cpp", "stopTrace", "Writing trace to '%s'...", trace_filename.c_str());
+
+        FILE *fp = fopen(trace_filename.c_str(), "w");
+        if (fp == NULL) {
+            Log(log_Error, "trace.cpp", "stopTrace", "   Failed to open trace file '%s'.", trace_filename.c_str());
+            return false;
+        }
+
+        lock_guard<mutex> lock(trace_mutex);
+
+        long pid = (long) getpid();
+        long count = 0;
+        bool first = true;
+
+        fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        for (size_t b = 0; b < trace_buffers.size(); b++) {
+
+            TraceBuffer *buffer = trace_buffers[b];
+
+            if (buffer->threadName != "") {
+                fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}", (first ? "" : ","), pid, buffer->tid, escapeJson(buffer->threadName).c_str());
+                first = false;
+            }
+
+            for (size_t i = 0; i < buffer->events.size(); i++) {
+                TraceEvent &e = buffer->events[i];
+                fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"dora\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f", (first ? "" : ","), escapeJson(e.name).c_str(), pid, buffer->tid, (e.start - trace_origin) / 1000.0, (e.end - e.start) / 1000.0);
+                if (e.detail != "")
+                    fprintf(fp, ",\"args\":{\"detail\":\"%s\"}", escapeJson(e.detail).c_str());
+                fprintf(fp, "}");
+                first = false;
+                count++;
+            }
+
+            buffer->events.clear();
+        }
+
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+
+        Log(log_Debug, "trace.cpp", "stopTrace", "   Done. %li events were written.", count);
+        return true;
+
+    } catch (const std::exception &e) {
+        Log(log_Error, "trace.cpp", "stopTrace", "   Failed to write trace: %s", e.what());
+    }
+
+    return false;
+}
@@ -0,0 +1,45 @@
+//
+// Guttemberg Machado on 17/10/26.
+//
+// Opt-in Chrome trace-event recorder ('--trace out.json'). Spans are kept in
+// per-thread buffers while the run goes on and written as one JSON file by
+// stopTrace(). The file opens in chrome://tracing or ui.perfetto.dev.
+//
+
+#ifndef DORA_TRACE_H
+#define DORA_TRACE_H
+
+#include <string>
+#include <atomic>
+#include "helper.h"
+
+using namespace std;
+
+extern atomic<bool> trace_enabled;
+
+bool startTrace(string filename);
+bool stopTrace();
+void setTraceThreadName(string name);
+
+void addTraceEvent(const char *name, const string &detail, int64 startNanoseconds, int64 endNanoseconds);
+int64 getTraceClock();
+
+//Records the lifetime of the scope as a complete ('X') event on the calling thread.
+//When tracing is off it costs one relaxed load.
+class TraceSpan {
+    const char *    mName;
+    string          mDetail;
+    int64           mStart;
+public:
+    explicit TraceSpan(const char *name, const char *detail = NULL)
+        : mName(name), mStart(trace_enabled.load(memory_order_relaxed) ? getTraceClock() : -1) {
+        if (mStart >= 0 && detail != NULL)
+            mDetail = detail;
+    }
+    ~TraceSpan() {
+        if (mStart >= 0)
+            addTraceEvent(mName, mDetail, mStart, getTraceClock());
+    }
+};
+
+#endif
@@ -5,6 +5,14 @@
 //TODO: Check both xCut and yCut cause they are not working properly
 
 #include "xycut.h"
+#include "binarization.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DORA_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+#define XYCUT_BLOCK_ROWS    65535   //rows counted before the 16 bit column counters are flushed
 
 bool getXCut(Mat &source, Mat &dest){
 
@@ -40,6 +48,104 @@ bool getYCut(Mat &source, Mat &dest){
 
 bool getXYCut(Mat &source, Mat &dest){
 
+	ProjectionProfile profile;
+	return (getProjectionProfile(source, profile) && drawXYCut(source, profile, dest));
+}
+
+//Black pixels (zeros) of every row and every column of rows [first, last). Columns are counted in 16 bit lanes,
+//which is why callers hand over at most 65535 rows at a time.
+static void countBlackScalar(const Mat &source, int first, int last, int *rowCount, uint16_t *colCount){
+
+	for (int y = first; y < last; y++) {
+		const uchar *in = source.ptr<uchar>(y);
+		int count = 0;
+		for (int x = 0; x < source.cols; x++) {
+			int black = (in[x] == 0);
+			count += black;
+			colCount[x] += black;
+		}
+		rowCount[y] = count;
+	}
+}
+
+#ifdef DORA_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void countBlackAVX2(const Mat &source, int first, int last, int *rowCount, uint16_t *colCount){
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+
+	for (int y = first; y < last; y++) {
+		const uchar *in = source.ptr<uchar>(y);
+		int count = 0;
+		int x = 0;
+
+		for (; x + 32 <= source.cols; x += 32) {
+			__m256i black = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (in + x)), zero);
+			count += __builtin_popcount((unsigned) _mm256_movemask_epi8(black));
+
+			__m256i ones = _mm256_and_si256(black, one);
+			__m256i low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(ones));
+			__m256i high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(ones, 1));
+			__m256i *columns = (__m256i *) (colCount + x);
+			_mm256_storeu_si256(columns, _mm256_add_epi16(_mm256_loadu_si256(columns), low));
+			_mm256_storeu_si256(columns + 1, _mm256_add_epi16(_mm256_loadu_si256(columns + 1), high));
+		}
+
+		for (; x < source.cols; x++) {
+			int black = (in[x] == 0);
+			count += black;
+			colCount[x] += black;
+		}
+		rowCount[y] = count;
+	}
+}
+#endif
+
+//One pass over the binary mat, 32 pixels at a time with AVX2 when the cpu has it
+bool getProjectionProfile(const Mat &source, ProjectionProfile &profile){
+
+	try{
+		CV_Assert(source.type() == CV_8UC1);
+
+		vector<int> rowCount(source.rows, 0);
+		vector<int> colCount(source.cols, 0);
+		vector<uint16_t> partial(source.cols);
+		bool simd = isBinarizationSIMD();
+
+		for (int first = 0; first < source.rows; first += XYCUT_BLOCK_ROWS) {
+			int last = min(first + XYCUT_BLOCK_ROWS, source.rows);
+			fill(partial.begin(), partial.end(), 0);
+#ifdef DORA_AVX2_DISPATCH
+			if (simd)
+				countBlackAVX2(source, first, last, rowCount.data(), partial.data());
+			else
+#endif
+				countBlackScalar(source, first, last, rowCount.data(), partial.data());
+			for (int x = 0; x < source.cols; x++)
+				colCount[x] += partial[x];
+		}
+
+		profile.rows.resize(source.rows);
+		profile.cols.resize(source.cols);
+		for (int y = 0; y < source.rows; y++)
+			profile.rows[y] = (float) rowCount[y] / source.cols;
+		for (int x = 0; x < source.cols; x++)
+			profile.cols[x] = (float) colCount[x] / source.rows;
+
+		return true;
+
+	}catch(const std::exception& e){
+		Log(log_Error, "xycut.cpp", "getProjectionProfile",  "         Failed to create projection profile: %s", e.what() ) ;
+	}
+
+	return false;
+}
+
+//The debug image: the mat on the top left, the black pixels of each row as a bar to its right and those of
+//each column as a bar below it. Only rendered when the XY cut artifact is dumped.
+bool drawXYCut(const Mat &source, const ProjectionProfile &profile, Mat &dest){
+
 	//========================================================================//
 	//                                                                        //
 	//   +--------+----+--------+                                             //
@@ -61,45 +167,107 @@ bool getXYCut(Mat &source, Mat &dest){
 	//========================================================================//
 
 	try{
-		//Cria o Mat
-		Mat1i xMat;
-		Mat1i yMat;
-
-		reduce(source, xMat, 0, CV_REDUCE_SUM); //0 = Colapse to a single COLUMN
-		reduce(source, yMat, 1, CV_REDUCE_SUM); //1 = Colapse to a single ROW
+		CV_Assert((int) profile.rows.size() == source.rows && (int) profile.cols.size() == source.cols);
 
-		Mat resultMat = Mat(source.rows * 2, source.cols * 2, CV_8U, Scalar::all(255));
+		dest.create(source.rows * 2, source.cols * 2, CV_8U);
+		dest.setTo(Scalar::all(255));
 
-		//We can normalize the result, in order to keey the values in a range using
-		//	normalize(xMat, xMat, 0, inputMat.cols , NORM_MINMAX, -1, Mat());
-		//	normalize(yMat, yMat, 0, inputMat.rows , NORM_MINMAX, -1, Mat());
-		// but since the binary image already uses 0 to 255 it is easier to just divide by 255
-		xMat = xMat / 255;
-		yMat = yMat / 255;
+		//Draws the row bars to the right side
+		for (int y = 0; y < source.rows; y++) {
+			int length = cvRound(profile.rows[y] * source.cols);
+			if (length > 0)
+				line(dest, Point(source.cols, y), Point(source.cols + length - 1, y), Scalar(0, 0, 0), 1, 8, 0);
+		}
 
-		//Draws the x representation to the right side
-		for (int y = 0; y < xMat.rows; y++)
-			line(resultMat, Point(source.cols, y), Point(source.cols + (source.cols - xMat.at<int>(y)), y), Scalar(0, 0, 0), 1, 8, 0);
-
-		//Draws the y representation to the lower side
-		for (int x = 0; x < yMat.cols; x++)
-			line(resultMat, Point(x, source.rows), Point(x, source.rows + (source.rows - yMat.at<int>(x))), Scalar(0, 0, 0), 1, 8, 0);
+		//Draws the column bars to the lower side
+		for (int x = 0; x < source.cols; x++) {
+			int length = cvRound(profile.cols[x] * source.rows);
+			if (length > 0)
+				line(dest, Point(x, source.rows), Point(x, source.rows + length - 1), Scalar(0, 0, 0), 1, 8, 0);
+		}
 
 		//Draws the original image
-		source.copyTo(resultMat(Rect(0, 0, source.cols, source.rows)));
+		source.copyTo(dest(Rect(0, 0, source.cols, source.rows)));
 
 		//Draw an edge
-		rectangle(resultMat, Point(0, 0), Point(source.cols, source.rows), Scalar(0, 0, 0), 1, 8, 0);
-		rectangle(resultMat, Point(1, 1), Point(source.cols - 1, source.rows - 1), Scalar(255, 255, 255), 1, 8, 0);
-		rectangle(resultMat, Point(2, 2), Point(source.cols - 2, source.rows - 2), Scalar(0, 0, 0), 1, 8, 0);
+		rectangle(dest, Point(0, 0), Point(source.cols, source.rows), Scalar(0, 0, 0), 1, 8, 0);
+		rectangle(dest, Point(1, 1), Point(source.cols - 1, source.rows - 1), Scalar(255, 255, 255), 1, 8, 0);
+		rectangle(dest, Point(2, 2), Point(source.cols - 2, source.rows - 2), Scalar(0, 0, 0), 1, 8, 0);
+
+		return true;
+
+	}catch(const std::exception& e){
+		Log(log_Error, "xycut.cpp", "drawXYCut",  "         Failed to create XYCCut mat: %s", e.what() ) ;
+	}
+
+	return false;
+}
+
+//Area averaging: every bin is the mean of the profile over its share of [0, n), partial values included, so
+//profiles shorter than the number of bins are stretched and longer ones are shrunk the same way
+static void resampleProfile(const vector<float> &profile, int bins, float *out){
+
+	int n = (int) profile.size();
+	if (n == 0) {
+		fill(out, out + bins, 0.0f);
+		return;
+	}
+
+	vector<double> prefix(n + 1, 0);
+	for (int i = 0; i < n; i++)
+		prefix[i + 1] = prefix[i] + profile[i];
+
+	//sum of the profile over [0, t)
+	auto area = [&](double t) {
+		int i = min((int) t, n - 1);
+		return prefix[i] + (t - i) * profile[i];
+	};
+
+	for (int b = 0; b < bins; b++) {
+		double first = (double) b * n / bins;
+		double last = (double) (b + 1) * n / bins;
+		out[b] = (float) ((area(last) - area(first)) / (last - first));
+	}
+}
+
+int getProjectionFeatureLength(int bins, int bands){
+	return 2 * bins * (bands + 1);
+}
+
+bool getProjectionFeatures(const Mat &source, const ProjectionProfile &profile, int bins, int bands, Mat &features){
+
+	try{
+		CV_Assert(source.type() == CV_8UC1 && bins > 0 && bands >= 0);
+		CV_Assert((int) profile.rows.size() == source.rows && (int) profile.cols.size() == source.cols);
+
+		features.create(1, getProjectionFeatureLength(bins, bands), CV_32F);
+		float *out = features.ptr<float>(0);
+
+		resampleProfile(profile.rows, bins, out);
+		resampleProfile(profile.cols, bins, out + bins);
+		out += 2 * bins;
 
-		//Draws to the destination mat
-		resultMat.copyTo(dest);
+		//Stripes too thin to hold a line (more bands than rows or columns) are left empty
+		ProjectionProfile band;
+		for (int b = 0; b < bands; b++, out += bins) {
+			int first = b * source.rows / bands, last = (b + 1) * source.rows / bands;
+			if (last > first && getProjectionProfile(source.rowRange(first, last), band))
+				resampleProfile(band.cols, bins, out);
+			else
+				fill(out, out + bins, 0.0f);
+		}
+		for (int b = 0; b < bands; b++, out += bins) {
+			int first = b * source.cols / bands, last = (b + 1) * source.cols / bands;
+			if (last > first && getProjectionProfile(source.colRange(first, last), band))
+				resampleProfile(band.rows, bins, out);
+			else
+				fill(out, out + bins, 0.0f);
+		}
 
 		return true;
 
 	}catch(const std::exception& e){
-		Log(log_Error, "xycut.cpp", "getXCut",  "         Failed to create XYCCut mat: %s", e.what() ) ;
+		Log(log_Error, "xycut.cpp", "getProjectionFeatures",  "         Failed to create projection features: %s", e.what() ) ;
 	}
 
 	return false;
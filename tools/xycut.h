@@ -12,9 +12,25 @@
 using namespace cv;
 using namespace std;
 
+//Projection profiles of a binary mat: the share of black pixels of every row and of every column (0 is a white
+//line, 1 a black one). They are what the XY cut image draws, without drawing it.
+struct ProjectionProfile {
+    vector<float>   rows;   //horizontal profile, one value per row
+    vector<float>   cols;   //vertical profile, one value per column
+};
+
 bool getXCut(Mat &source, Mat &dest);
 bool getYCut(Mat &source, Mat &dest);
 bool getXYCut(Mat &source, Mat &dest);
 
+bool getProjectionProfile(const Mat &source, ProjectionProfile &profile);
+bool drawXYCut(const Mat &source, const ProjectionProfile &profile, Mat &dest);
+
+//Fixed length feature row (CV_32F) of a binary mat: its row and column profiles resampled to 'bins' values each,
+//followed by the column profile of each of 'bands' horizontal stripes and the row profile of each of 'bands'
+//vertical stripes (none when 'bands' is 0). Its length depends on bins and bands only, never on the mat size.
+int  getProjectionFeatureLength(int bins, int bands);
+bool getProjectionFeatures(const Mat &source, const ProjectionProfile &profile, int bins, int bands, Mat &features);
+
 #endif
 